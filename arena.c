@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "network.h"
+
+
+// chunks added after the first are at least this large
+#define ARENA_CHUNK_SIZE 4096
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} arena_chunk;
+
+struct arena {
+    arena_chunk *chunks;
+    uint64_t mallocs;
+};
+
+
+arena* arena_new(size_t size)
+{
+    size = ARENA_ROUND(size);
+    // arena, then the first chunk
+    size_t offset = ARENA_ROUND(sizeof(arena));
+    arena *a = malloc(offset + sizeof(arena_chunk) + size);
+    if (!a) {
+        return NULL;
+    }
+    arena_chunk *c = (arena_chunk*)((uint8_t*)a + offset);
+    c->next = NULL;
+    c->size = size;
+    c->used = 0;
+    a->chunks = c;
+    a->mallocs = 1;
+    return a;
+}
+
+void* arena_alloc(arena *a, size_t size)
+{
+    size = ARENA_ROUND(MAX(size, 1));
+    arena_chunk *c = a->chunks;
+    if (c->size - c->used < size) {
+        size_t chunk_size = MAX(size, ARENA_CHUNK_SIZE);
+        c = malloc(sizeof(arena_chunk) + chunk_size);
+        if (!c) {
+            return NULL;
+        }
+        c->size = chunk_size;
+        c->used = 0;
+        c->next = a->chunks;
+        a->chunks = c;
+        a->mallocs++;
+    }
+    void *p = (uint8_t*)c->data + c->used;
+    c->used += size;
+    memset(p, 0, size);
+    return p;
+}
+
+char* arena_strdup(arena *a, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *d = arena_alloc(a, len);
+    if (d) {
+        memcpy(d, s, len);
+    }
+    return d;
+}
+
+uint64_t arena_mallocs(const arena *a)
+{
+    return a->mallocs;
+}
+
+void arena_free(arena *a)
+{
+    if (!a) {
+        return;
+    }
+    // the last chunk in the list is the one allocated with the arena
+    arena_chunk *c = a->chunks;
+    while (c->next) {
+        arena_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    free(a);
+}
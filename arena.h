@@ -0,0 +1,21 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// request-scoped memory: small allocations come out of one region, which is released with
+// a single arena_free(). the region grows in chunks when it fills up, nothing is freed early.
+typedef struct arena arena;
+
+// the first chunk holds at least size bytes, and comes with the arena in one malloc
+arena* arena_new(size_t size);
+// zeroed, aligned for any type
+void* arena_alloc(arena *a, size_t size);
+char* arena_strdup(arena *a, const char *s);
+// mallocs made so far, for request_cost
+uint64_t arena_mallocs(const arena *a);
+void arena_free(arena *a);
+
+#endif // __ARENA_H__
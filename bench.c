@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <Block.h>
+
+#include <sodium.h>
+
+#include <event2/buffer.h>
+
+#include "log.h"
+#include "http.h"
+#include "sha1.h"
+#include "obfoo.h"
+#include "peer.h"
+#include "timer.h"
+#include "base64.h"
+#include "network.h"
+#include "hash_table.h"
+#include "merkle_tree.h"
+
+
+// microbenchmarks for core primitives. one JSON object per line:
+//   {"bench":"base64_encode","case":"1KB","ops":..,"ns_per_op":..,"bytes_per_sec":..}
+// bytes_per_sec is 0 for benchmarks that don't process data.
+
+typedef void (^bench_fn)(uint64_t iterations);
+
+double o_min_time = 0.5;
+const char *o_filter;
+bool o_quick;
+
+uint64_t ns_clock()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void bench(const char *name, const char *variant, uint64_t bytes_per_op, bench_fn fn)
+{
+    if (o_filter && !strstr(name, o_filter)) {
+        return;
+    }
+    // grow the iteration count until one run takes at least o_min_time
+    uint64_t iterations = 1;
+    uint64_t elapsed;
+    for (;;) {
+        uint64_t start = ns_clock();
+        fn(iterations);
+        elapsed = ns_clock() - start;
+        if (elapsed >= o_min_time * 1e9 || iterations >= (1ULL << 40)) {
+            break;
+        }
+        uint64_t target = elapsed ? (uint64_t)(o_min_time * 1e9 * 1.2 * iterations / elapsed) : iterations * 100;
+        iterations = MAX(iterations + 1, MIN(target, iterations * 100));
+    }
+    double ns_per_op = (double)elapsed / iterations;
+    double bytes_per_sec = bytes_per_op ? (double)bytes_per_op * iterations * 1e9 / elapsed : 0;
+    printf("{\"bench\":\"%s\",\"case\":\"%s\",\"ops\":%"PRIu64",\"ns_per_op\":%.1f,\"bytes_per_sec\":%.0f}\n",
+           name, variant, iterations, ns_per_op, bytes_per_sec);
+    fflush(stdout);
+}
+
+const char* size_str(uint64_t size)
+{
+    static char buf[32];
+    if (size >= 1024 * 1024 * 1024 && !(size % (1024 * 1024 * 1024))) {
+        snprintf(buf, sizeof(buf), "%"PRIu64"GB", size / (1024 * 1024 * 1024));
+    } else if (size >= 1024 * 1024 && !(size % (1024 * 1024))) {
+        snprintf(buf, sizeof(buf), "%"PRIu64"MB", size / (1024 * 1024));
+    } else if (size >= 1024 && !(size % 1024)) {
+        snprintf(buf, sizeof(buf), "%"PRIu64"KB", size / 1024);
+    } else {
+        snprintf(buf, sizeof(buf), "%"PRIu64"B", size);
+    }
+    return buf;
+}
+
+void bench_merkle_tree()
+{
+    // large trees are fed from one buffer, the way chunked_cb feeds it from the network
+    size_t piece = 1024 * 1024;
+    uint8_t *data = malloc(piece);
+    randombytes_buf(data, piece);
+
+    uint64_t sizes[] = {1024, 16 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024,
+                        256 * 1024 * 1024, 1024 * 1024 * 1024};
+    for (size_t i = 0; i < lenof(sizes); i++) {
+        uint64_t size = sizes[i];
+        if (o_quick && size > 16 * 1024 * 1024) {
+            continue;
+        }
+        bench("merkle_tree", size_str(size), size, ^(uint64_t iterations) {
+            for (uint64_t j = 0; j < iterations; j++) {
+                merkle_tree *m = alloc(merkle_tree);
+                for (uint64_t off = 0; off < size; off += piece) {
+                    merkle_tree_add_hashed_data(m, data, MIN(piece, size - off));
+                }
+                uint8_t root[crypto_generichash_BYTES];
+                merkle_tree_get_root(m, root);
+                merkle_tree_free(m);
+            }
+        });
+    }
+
+    uint64_t evsize = 1024 * 1024;
+    bench("merkle_tree_add_evbuffer", size_str(evsize), evsize, ^(uint64_t iterations) {
+        evbuffer *buf = evbuffer_new();
+        for (uint64_t j = 0; j < iterations; j++) {
+            evbuffer_add_reference(buf, data, evsize, NULL, NULL);
+            merkle_tree *m = alloc(merkle_tree);
+            merkle_tree_add_evbuffer(m, buf);
+            uint8_t root[crypto_generichash_BYTES];
+            merkle_tree_get_root(m, root);
+            merkle_tree_free(m);
+            evbuffer_drain(buf, evbuffer_get_length(buf));
+        }
+        evbuffer_free(buf);
+    });
+
+    free(data);
+}
+
+void obfoo_handshake(obfoo *out, obfoo *in)
+{
+    evbuffer *sink = evbuffer_new();
+    obfoo_write_intro(out, out->output);
+    for (int i = 0; i < 8 && (out->state != OF_STATE_READY || in->state != OF_STATE_READY); i++) {
+        obfoo_input_filter(out->output, sink, in);
+        obfoo_input_filter(in->output, sink, out);
+    }
+    if (out->state != OF_STATE_READY || in->state != OF_STATE_READY) {
+        die("obfoo handshake did not complete\n");
+    }
+    evbuffer_free(sink);
+}
+
+void bench_obfoo()
+{
+    obfoo *a = obfoo_new();
+    a->output = evbuffer_new();
+    a->incoming = false;
+    obfoo *b = obfoo_new();
+    b->output = evbuffer_new();
+    b->incoming = true;
+    obfoo_handshake(a, b);
+
+    static uint8_t data[256 * 1024];
+    randombytes_buf(data, sizeof(data));
+
+    // (segments, segment size): one big read, uTP packet sized writes, and tiny writes
+    struct {
+        size_t segments;
+        size_t size;
+    } shapes[] = {{1, 256 * 1024}, {16, 16 * 1024}, {256, 1024}, {1024, 64}};
+    for (size_t i = 0; i < lenof(shapes); i++) {
+        size_t segments = shapes[i].segments;
+        size_t size = shapes[i].size;
+        char variant[64];
+        snprintf(variant, sizeof(variant), "%zux%s", segments, size_str(size));
+        bench("obfoo_encrypt", variant, segments * size, ^(uint64_t iterations) {
+            evbuffer *in = evbuffer_new();
+            evbuffer *out = evbuffer_new();
+            for (uint64_t j = 0; j < iterations; j++) {
+                for (size_t s = 0; s < segments; s++) {
+                    evbuffer_add_reference(in, &data[s * size], size, NULL, NULL);
+                }
+                obfoo_output_filter(in, out, a);
+                evbuffer_drain(out, evbuffer_get_length(out));
+            }
+            evbuffer_free(in);
+            evbuffer_free(out);
+        });
+        bench("obfoo_decrypt", variant, segments * size, ^(uint64_t iterations) {
+            evbuffer *in = evbuffer_new();
+            evbuffer *out = evbuffer_new();
+            for (uint64_t j = 0; j < iterations; j++) {
+                for (size_t s = 0; s < segments; s++) {
+                    evbuffer_add_reference(in, &data[s * size], size, NULL, NULL);
+                }
+                obfoo_input_filter(in, out, b);
+                evbuffer_drain(out, evbuffer_get_length(out));
+            }
+            evbuffer_free(in);
+            evbuffer_free(out);
+        });
+    }
+
+    evbuffer_free(a->output);
+    evbuffer_free(b->output);
+    obfoo_free(a);
+    obfoo_free(b);
+}
+
+void bench_base64()
+{
+    // a content_sig is 120 bytes, X-Hashes is 32 bytes per 16KB leaf
+    size_t sizes[] = {32, sizeof(content_sig), 1024, 64 * 1024};
+    for (size_t i = 0; i < lenof(sizes); i++) {
+        size_t size = sizes[i];
+        uint8_t *data = malloc(size);
+        randombytes_buf(data, size);
+        size_t encoded_len;
+        char *encoded = base64_urlsafe_encode(data, size, &encoded_len);
+
+        bench("base64_encode", size_str(size), size, ^(uint64_t iterations) {
+            for (uint64_t j = 0; j < iterations; j++) {
+                size_t out_len;
+                free(base64_urlsafe_encode(data, size, &out_len));
+            }
+        });
+        bench("base64_decode", size_str(size), size, ^(uint64_t iterations) {
+            for (uint64_t j = 0; j < iterations; j++) {
+                size_t out_len;
+                free(base64_decode(encoded, encoded_len, &out_len));
+            }
+        });
+
+        free(encoded);
+        free(data);
+    }
+}
+
+void bench_sha1()
+{
+    size_t sizes[] = {20, 64, 1024, 64 * 1024};
+    for (size_t i = 0; i < lenof(sizes); i++) {
+        size_t size = sizes[i];
+        uint8_t *data = malloc(size);
+        randombytes_buf(data, size);
+        bench("sha1", size_str(size), size, ^(uint64_t iterations) {
+            unsigned char hash[20];
+            for (uint64_t j = 0; j < iterations; j++) {
+                SHA1(hash, data, (unsigned int)size);
+            }
+        });
+        free(data);
+    }
+}
+
+void bench_hash_table()
+{
+    size_t sizes[] = {100, 10000, 1000000};
+    for (size_t i = 0; i < lenof(sizes); i++) {
+        size_t count = sizes[i];
+        if (o_quick && count > 10000) {
+            continue;
+        }
+        // keys are not owned by the table
+        char **keys = malloc(count * sizeof(char*));
+        for (size_t k = 0; k < count; k++) {
+            char key[64];
+            snprintf(key, sizeof(key), "host-%zu.example.com", k);
+            keys[k] = strdup(key);
+        }
+        char variant[32];
+        snprintf(variant, sizeof(variant), "%zu", count);
+
+        bench("hash_table_insert", variant, 0, ^(uint64_t iterations) {
+            hash_table *h = hash_table_create();
+            for (uint64_t j = 0; j < iterations; j++) {
+                if (!(j % count) && j) {
+                    hash_table_free(h);
+                    h = hash_table_create();
+                }
+                hash_set(h, keys[j % count], keys);
+            }
+            hash_table_free(h);
+        });
+
+        hash_table *h = hash_table_create();
+        for (size_t k = 0; k < count; k++) {
+            hash_set(h, keys[k], keys);
+        }
+        bench("hash_table_lookup", variant, 0, ^(uint64_t iterations) {
+            for (uint64_t j = 0; j < iterations; j++) {
+                if (!hash_get(h, keys[(j * 7919) % count])) {
+                    die("missing key\n");
+                }
+            }
+        });
+        hash_table_free(h);
+
+        for (size_t k = 0; k < count; k++) {
+            free(keys[k]);
+        }
+        free(keys);
+    }
+}
+
+void bench_timer_cb(void *arg)
+{
+}
+
+void bench_timer()
+{
+    network *n = alloc(network);
+    n->evbase = event_base_new();
+
+    __block uint64_t fired = 0;
+    bench("timer_start_cancel", "-", 0, ^(uint64_t iterations) {
+        for (uint64_t j = 0; j < iterations; j++) {
+            timer *t = timer_start(n, 1000, ^{
+                fired++;
+            });
+            timer_cancel(t);
+        }
+    });
+    bench("timer_fire", "-", 0, ^(uint64_t iterations) {
+        for (uint64_t j = 0; j < iterations; j++) {
+            timer_start(n, 0, ^{
+                fired++;
+            });
+            event_base_loop(n->evbase, EVLOOP_ONCE);
+        }
+    });
+
+    // embedded timers, which don't allocate
+    timer *t = alloc(timer);
+    timer_init(t, n, bench_timer_cb, NULL);
+    bench("timer_schedule_stop", "-", 0, ^(uint64_t iterations) {
+        for (uint64_t j = 0; j < iterations; j++) {
+            timer_schedule(t, 1000);
+            timer_stop(t);
+        }
+    });
+    bench("timer_schedule_fire", "-", 0, ^(uint64_t iterations) {
+        for (uint64_t j = 0; j < iterations; j++) {
+            timer_schedule(t, 0);
+            event_base_loop(n->evbase, EVLOOP_ONCE);
+        }
+    });
+    free(t);
+
+    event_base_free(n->evbase);
+    free(n);
+}
+
+void bench_generichash()
+{
+    // baseline for merkle_tree and chunk verification
+    size_t sizes[] = {64, LEAF_CHUNK_SIZE};
+    for (size_t i = 0; i < lenof(sizes); i++) {
+        size_t size = sizes[i];
+        uint8_t *data = malloc(size);
+        randombytes_buf(data, size);
+        bench("generichash", size_str(size), size, ^(uint64_t iterations) {
+            uint8_t hash[crypto_generichash_BYTES];
+            for (uint64_t j = 0; j < iterations; j++) {
+                crypto_generichash(hash, sizeof(hash), data, size, NULL, 0);
+            }
+        });
+        free(data);
+    }
+}
+
+// defined by caller
+void bench_peers()
+{
+    size_t sizes[] = {100, 10000, 100000};
+    for (size_t i = 0; i < lenof(sizes); i++) {
+        size_t count = sizes[i];
+        peer_array *pa = alloc(peer_array);
+        for (size_t k = 0; k < count; k++) {
+            peer *p = alloc(peer);
+            sockaddr_in *sin = (sockaddr_in*)&p->addr;
+            sin->sin_family = AF_INET;
+            sin->sin_addr.s_addr = htonl(0x0A000000 + (uint32_t)k);
+            sin->sin_port = htons(6881);
+            // mostly DHT peers which were never tried, some known good ones
+            if (!(k % 20)) {
+                p->last_verified = 1000 + k;
+                p->last_connect = 1000 + k;
+            }
+            // a few which the request filter rejects
+            p->via = !(k % 100);
+            peer_array_add(&pa, p);
+        }
+        char variant[32];
+        snprintf(variant, sizeof(variant), "%zu", count);
+
+        // the connect path: pick the best peer, then it moves back for trying
+        __block time_t now = 2000000;
+        bench("select_peer", variant, 0, ^(uint64_t iterations) {
+            for (uint64_t j = 0; j < iterations; j++) {
+                peer *p = select_peer(pa, NULL);
+                p->last_connect_attempt = now++;
+                peer_updated(p);
+            }
+        });
+        bench("select_peer_filtered", variant, 0, ^(uint64_t iterations) {
+            for (uint64_t j = 0; j < iterations; j++) {
+                peer *p = select_peer(pa, ^bool(peer *c) {
+                    return c->via;
+                });
+                p->last_connect_attempt = now++;
+                peer_updated(p);
+            }
+        });
+        // what selection cost as a scan with a random salt per peer
+        bench("select_peer_scan", variant, 0, ^(uint64_t iterations) {
+            for (uint64_t j = 0; j < iterations; j++) {
+                peer *best = NULL;
+                for (uint k = 0; k < pa->length; k++) {
+                    peer *p = pa->peers[k];
+                    p->salt = randombytes_uniform(0xFF);
+                    if (!best || peer_cmp(p, best) < 0) {
+                        best = p;
+                    }
+                }
+                best->last_connect_attempt = now++;
+            }
+        });
+        peer_array_reorder(pa);
+        bench("get_peer", variant, 0, ^(uint64_t iterations) {
+            for (uint64_t j = 0; j < iterations; j++) {
+                peer *p = pa->peers[(j * 7919) % count];
+                if (get_peer(pa, (const sockaddr *)&p->addr, sizeof(sockaddr_in)) != p) {
+                    die("missing peer\n");
+                }
+            }
+        });
+    }
+}
+
+void add_sockaddr(network *n, const sockaddr *addr, socklen_t addrlen)
+{
+}
+
+void dht_event_callback(void *closure, int event, const unsigned char *info_hash, const void *data, size_t data_len)
+{
+}
+
+void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-f filter] [-t min_seconds] [-q]\n", name);
+    fprintf(stderr, "  -f  only run benchmarks whose name contains filter\n");
+    fprintf(stderr, "  -t  minimum run time per case (default %.1f)\n", o_min_time);
+    fprintf(stderr, "  -q  quick: skip the largest sizes\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    for (;;) {
+        int c = getopt(argc, argv, "f:t:q");
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+        case 'f':
+            o_filter = optarg;
+            break;
+        case 't':
+            o_min_time = atof(optarg);
+            break;
+        case 'q':
+            o_quick = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (sodium_init() == -1) {
+        die("sodium_init failed\n");
+    }
+
+    bench_merkle_tree();
+    bench_generichash();
+    bench_obfoo();
+    bench_base64();
+    bench_sha1();
+    bench_hash_table();
+    bench_timer();
+    bench_peers();
+    return 0;
+}
@@ -93,8 +93,8 @@ function build_android {
 
     rm *.o || true
     $CC $CFLAGS -c dht/dht.c -o dht_dht.o
-    for file in android.c bev_splice.c base64.c client.c dht.c http.c log.c lsd.c \
-                icmp_handler.c hash_table.c merkle_tree.c network.c obfoo.c sha1.c thread.c timer.c utp_bufferevent.c \
+    for file in android.c arena.c bev_splice.c base64.c client.c dht.c http.c log.c lsd.c \
+                icmp_handler.c cost.c hash_table.c histogram.c load.c metrics.c netem.c merkle_tree.c network.c obfoo.c peer.c sha1.c thread.c timeline.c timer.c trace.c utp_bufferevent.c vtime.c \
                 bugsnag/bugsnag_ndk.c \
                 bugsnag/bugsnag_ndk_report.c \
                 bugsnag/bugsnag_unwind.c \
@@ -55,9 +55,9 @@ function build_ios {
     rm -rf $TRIPLE || true
     rm *.o || true
     clang $CFLAGS -c dht/dht.c -o dht_dht.o
-    for file in bev_splice.c base64.c client.c dht.c d2d.c http.c log.c lsd.c \
-                icmp_handler.c hash_table.c merkle_tree.c network.c \
-                obfoo.c sha1.c timer.c thread.c utp_bufferevent.c; do
+    for file in arena.c bev_splice.c base64.c client.c dht.c d2d.c http.c log.c lsd.c \
+                icmp_handler.c cost.c hash_table.c histogram.c load.c metrics.c netem.c merkle_tree.c network.c \
+                obfoo.c peer.c sha1.c timeline.c timer.c thread.c trace.c utp_bufferevent.c vtime.c; do
         clang $CFLAGS $LIBUTP_CFLAGS $LIBEVENT_CFLAGS $LIBSODIUM_CFLAGS $LIBBUGSNAG_CFLAGS -c $file
     done
     clang -fobjc-arc -fobjc-weak -fmodules $CFLAGS $LIBUTP_CFLAGS $LIBEVENT_CFLAGS $LIBSODIUM_CFLAGS $LIBBUGSNAG_CFLAGS -I ios -c ios/NetService.m ios/Framework/NewNode.m
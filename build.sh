@@ -33,8 +33,24 @@ LIBSODIUM_CFLAGS=-Ilibsodium/native/include
 LIBSODIUM=libsodium/native/lib/libsodium.a
 
 
+# RELEASE=1 builds optimized, with LTO and without sanitizers; PGO=1 additionally trains
+# the release build on the loopback load test (load.sh) and rebuilds it with that profile.
+# without RELEASE, the build is the -O0 sanitizer build for development.
+if [ ! -z ${RELEASE+x} ]; then
+    MODE=release
+    UTP_OPT=-O2
+else
+    MODE=debug
+    UTP_OPT="-O0 -fno-inline -fno-optimize-sibling-calls"
+fi
+
+
 cd libutp
-test -f libutp.a || (make clean && OPT=-O0 CPPFLAGS="-fno-exceptions -fno-common -fno-inline -fno-optimize-sibling-calls -funwind-tables -fno-omit-frame-pointer -fstack-protector-all" make -j3 libutp.a)
+if [ ! -f libutp.a ] || [ "$(cat native.mode 2>/dev/null)" != $MODE ]; then
+    make clean
+    OPT="$UTP_OPT" CPPFLAGS="-fno-exceptions -fno-common -funwind-tables -fno-omit-frame-pointer -fstack-protector-all" make -j3 libutp.a
+    echo $MODE > native.mode
+fi
 cd ..
 LIBUTP_CFLAGS=-Ilibutp
 LIBUTP=libutp/libutp.a
@@ -56,13 +72,22 @@ fi
 
 FLAGS="-g -Werror -Wall -Wextra -Wno-deprecated-declarations -Wno-unused-parameter -Wno-unused-variable -Wno-error=shadow -Wfatal-errors \
   -fPIC -fblocks -fdata-sections -ffunction-sections \
-  -fno-rtti -fno-exceptions -fno-common -fno-inline -fno-optimize-sibling-calls -funwind-tables -fno-omit-frame-pointer -fstack-protector-all \
+  -fno-rtti -fno-exceptions -fno-common -funwind-tables -fno-omit-frame-pointer -fstack-protector-all \
   -D__FAVOR_BSD -D_BSD_SOURCE -D_DEFAULT_SOURCE"
-# -fvisibility=hidden -fvisibility-inlines-hidden -flto=thin \
-if [ ! -z ${DEBUG+x} ]; then
-    FLAGS="$FLAGS -O0 -DDEBUG=1 -fsanitize=address -fsanitize=undefined --coverage"
+# -fvisibility=hidden -fvisibility-inlines-hidden \
+if [ $MODE = release ]; then
+    FLAGS="$FLAGS -O2 -flto=thin"
+    if [ ! -z ${DEBUG+x} ]; then
+        FLAGS="$FLAGS -DDEBUG=1"
+    fi
+    # the system linker may not understand LTO objects
+    if ! uname|grep -i Darwin >/dev/null; then
+        echo "int main() {}"|clang -x c - -flto=thin -fuse-ld=lld 2>/dev/null && FLAGS="$FLAGS -fuse-ld=lld"
+    fi
+elif [ ! -z ${DEBUG+x} ]; then
+    FLAGS="$FLAGS -O0 -fno-inline -fno-optimize-sibling-calls -DDEBUG=1 -fsanitize=address -fsanitize=undefined --coverage"
 else
-    FLAGS="$FLAGS -O0 -fsanitize=address -fsanitize=undefined"
+    FLAGS="$FLAGS -O0 -fno-inline -fno-optimize-sibling-calls -fsanitize=address -fsanitize=undefined"
 fi
 
 CFLAGS="$FLAGS -std=gnu11"
@@ -75,17 +100,44 @@ echo "int main() {}"|clang -x c - -lrt 2>/dev/null && LRT="-lrt"
 LM=
 echo -e "#include <math.h>\nint main() { log(2); }"|clang -x c - 2>/dev/null || LM="-lm"
 
-rm *.o || true
-clang $CFLAGS -c dht/dht.c -o dht_dht.o
-for file in client.c client_main.c d2d.c injector.c dht.c bev_splice.c base64.c http.c log.c lsd.c icmp_handler.c hash_table.c \
-            merkle_tree.c network.c obfoo.c sha1.c timer.c thread.c utp_bufferevent.c; do
-    clang $CFLAGS $LIBUTP_CFLAGS $LIBEVENT_CFLAGS $LIBSODIUM_CFLAGS $LIBBLOCKSRUNTIME_CFLAGS -c $file
-done
-
-mv client.o client.o.tmp
-mv client_main.o client_main.o.tmp
-clang $CFLAGS -o injector *.o $LRT $LM $LIBUTP $LIBEVENT $LIBSODIUM $LIBBLOCKSRUNTIME -lpthread
-mv injector.o injector.o.tmp
-mv client.o.tmp client.o
-mv client_main.o.tmp client_main.o
-clang $CFLAGS -o client *.o $LRT $LM $LIBUTP $LIBEVENT $LIBSODIUM $LIBBLOCKSRUNTIME -lpthread
+function build {
+    local CFLAGS="$CFLAGS ${1:-}"
+
+    rm *.o || true
+    clang $CFLAGS -c dht/dht.c -o dht_dht.o
+    for file in arena.c client.c client_main.c d2d.c injector.c dht.c bev_splice.c base64.c http.c log.c lsd.c icmp_handler.c cost.c hash_table.c histogram.c load.c metrics.c netem.c \
+                merkle_tree.c network.c obfoo.c peer.c sha1.c timeline.c timer.c thread.c trace.c utp_bufferevent.c vtime.c; do
+        clang $CFLAGS $LIBUTP_CFLAGS $LIBEVENT_CFLAGS $LIBSODIUM_CFLAGS $LIBBLOCKSRUNTIME_CFLAGS -c $file
+    done
+
+    mv client.o client.o.tmp
+    mv client_main.o client_main.o.tmp
+    clang $CFLAGS -o injector *.o $LRT $LM $LIBUTP $LIBEVENT $LIBSODIUM $LIBBLOCKSRUNTIME -lpthread
+    mv injector.o injector.o.tmp
+    mv client.o.tmp client.o
+    mv client_main.o.tmp client_main.o
+    clang $CFLAGS -o client *.o $LRT $LM $LIBUTP $LIBEVENT $LIBSODIUM $LIBBLOCKSRUNTIME -lpthread
+
+    mv client.o client.o.tmp
+    mv client_main.o client_main.o.tmp
+    for tool in bench loadgen utp_bench; do
+        clang $CFLAGS $LIBUTP_CFLAGS $LIBEVENT_CFLAGS $LIBSODIUM_CFLAGS $LIBBLOCKSRUNTIME_CFLAGS -c $tool.c
+        clang $CFLAGS -o $tool *.o $LRT $LM $LIBUTP $LIBEVENT $LIBSODIUM $LIBBLOCKSRUNTIME -lpthread
+        rm $tool.o
+    done
+    mv client.o.tmp client.o
+    mv client_main.o.tmp client_main.o
+}
+
+if [ $MODE = release ] && [ ! -z ${PGO+x} ]; then
+    # the injector only signs with the DEBUG test key, so the training build is always DEBUG=1,
+    # and a failed training run fails the build instead of leaving a partial profile
+    rm -rf pgo
+    mkdir pgo
+    build "-fprofile-instr-generate -DDEBUG=1"
+    LLVM_PROFILE_FILE=$(pwd)/pgo/%p.profraw ./load.sh ${PGO_LOAD:--c 32 -n 20000 -s 1024:60,65536:30,1048576:10 -C 10}
+    llvm-profdata merge -o pgo/newnode.profdata pgo/*.profraw
+    build "-fprofile-instr-use=$(pwd)/pgo/newnode.profdata -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date"
+else
+    build
+fi
@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Builds the debug (sanitizer) and release variants and runs the same benchmarks on both.
+#
+#   PGO=1 ./builds.sh -c 64 -n 20000 -s 1024:60,65536:30,4194304:10
+#
+# Arguments are passed to load.sh. Each variant gets the microbenchmarks (bench -q) and the
+# loopback load test; every JSON line is tagged with "build". PGO=1 adds a release build
+# trained with profile-guided optimization. Builds with DEBUG=1 so the injector can sign.
+# The tree is left with the debug build.
+
+set -e
+
+BIN=$(cd $(dirname $0) && pwd)
+WORK=$(mktemp -d)
+
+function cleanup {
+    rm -rf $WORK
+}
+trap cleanup EXIT
+trap 'exit 1' HUP INT TERM
+
+function now {
+    date +'%M:%S'
+}
+
+# variant <name> <env...>: build and keep a copy of the binaries and scripts
+function variant {
+    local name=$1
+    shift
+    echo "$(now) Building $name."
+    (cd $BIN && env DEBUG=1 "$@" ./build.sh > $WORK/build-$name.log 2>&1) || {
+        tail -20 $WORK/build-$name.log
+        exit 1
+    }
+    mkdir $WORK/$name
+    (cd $BIN && cp client injector loadgen bench utp_bench load.sh $WORK/$name)
+    variants+=($name)
+}
+
+variants=()
+variant release RELEASE=1
+if [ ! -z ${PGO+x} ]; then
+    variant pgo RELEASE=1 PGO=1
+fi
+variant debug
+
+# tag <name>: prefix every JSON line with the build name
+function tag {
+    sed -n "s/^{/{\"build\":\"$1\",/p"
+}
+
+r=0
+for name in ${variants[@]}; do
+    echo "$(now) Benchmarking $name."
+    $WORK/$name/bench -q | tag $name
+    $WORK/$name/load.sh "$@" | tag $name || r=1
+done
+
+echo "$(now) DONE"
+exit $r
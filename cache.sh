@@ -0,0 +1,93 @@
+#!/bin/bash
+
+# Cache-hit serving benchmark: fills a client's cache through a local injector, then
+# measures how fast the client serves those objects back from the cache.
+# Build with `DEBUG=1 ./build.sh` so cached responses carry signatures the client accepts.
+#
+#   OBJECTS=200 SIZES=2048:40,16384:30,131072:20,1048576:10 ./cache.sh -c 32 -d 20 -R 25
+#
+# OBJECTS distinct URLs of each size are fetched once, then loadgen runs with the same URLs
+# and the remaining arguments (see ./loadgen -h; -R sends If-None-Match revalidations).
+# Prints loadgen's JSON lines, then one with the client's cache hit counts for the run.
+
+set -e
+
+ORIGIN_PORT=${ORIGIN_PORT:-8000}
+INJECTOR_PORT=${INJECTOR_PORT:-8005}
+CLIENT_PORT=${CLIENT_PORT:-8100}
+OBJECTS=${OBJECTS:-100}
+SIZES=${SIZES:-2048:40,16384:30,131072:20,1048576:10}
+
+BIN=$(cd $(dirname $0) && pwd)
+WORK=$(mktemp -d)
+
+function cleanup {
+    kill -SIGTERM $(jobs -pr) 2>/dev/null || true
+    rm -rf $WORK
+}
+trap cleanup EXIT
+trap 'exit 1' HUP INT TERM
+
+function now {
+    date +'%M:%S'
+}
+
+function wait_port {
+    for i in $(seq 100); do
+        if (echo > /dev/tcp/127.0.0.1/$1) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "$(now) port $1 did not open"
+    return 1
+}
+
+# metric <name{labels}>
+function metric {
+    curl -s http://127.0.0.1:$CLIENT_PORT/metrics | awk -v k="$1" '$1 == k { v = $2 } END { print v == "" ? 0 : v }'
+}
+
+#-------------------------------------------------------------------------------
+echo "$(now) Starting origin, injector and client."
+$BIN/loadgen -O $ORIGIN_PORT > $WORK/origin.log 2>&1 &
+wait_port $ORIGIN_PORT
+mkdir -p $WORK/injector $WORK/client
+(cd $WORK/injector && exec $BIN/injector -p $INJECTOR_PORT > log 2>&1) &
+wait_port $INJECTOR_PORT
+(cd $WORK/client && exec $BIN/client -p $CLIENT_PORT -i 127.0.0.1:$INJECTOR_PORT > log 2>&1) &
+wait_port $CLIENT_PORT
+
+#-------------------------------------------------------------------------------
+sizes=$(echo $SIZES | tr ',' '\n' | wc -l)
+objects=$((sizes * OBJECTS))
+echo "$(now) Populating the cache with $objects objects."
+$BIN/loadgen -u 127.0.0.1:$ORIGIN_PORT -x 127.0.0.1:$CLIENT_PORT -k -N $OBJECTS -P -s $SIZES -c 8 > $WORK/populate.log || \
+    echo "$(now) some objects failed to fetch."
+
+# objects are written once the injector confirms them, after the response
+for i in $(seq 300); do
+    cached=$(ls $WORK/client/cache 2>/dev/null | grep -v -c -e '\.headers$' -e '^cache\.' || true)
+    if [ $cached -ge $objects ]; then
+        break
+    fi
+    sleep 0.1
+done
+echo "$(now) $cached objects cached."
+
+#-------------------------------------------------------------------------------
+hits=$(metric 'newnode_cache_requests_total{result="hit"}')
+not_modified=$(metric 'newnode_cache_requests_total{result="not_modified"}')
+misses=$(metric 'newnode_cache_requests_total{result="miss"}')
+
+echo "$(now) Running hits through 127.0.0.1:$CLIENT_PORT."
+r=0
+$BIN/loadgen -u 127.0.0.1:$ORIGIN_PORT -x 127.0.0.1:$CLIENT_PORT -k -N $OBJECTS -s $SIZES "$@" || r=$?
+
+hits=$(($(metric 'newnode_cache_requests_total{result="hit"}') - hits))
+not_modified=$(($(metric 'newnode_cache_requests_total{result="not_modified"}') - not_modified))
+misses=$(($(metric 'newnode_cache_requests_total{result="miss"}') - misses))
+echo "{\"cached\":$cached,\"hits\":$hits,\"not_modified\":$not_modified,\"misses\":$misses}"
+
+echo "$(now) DONE"
+exit $r
@@ -1,6 +1,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
@@ -28,6 +29,7 @@
 #include "utp.h"
 #include "http.h"
 #include "timer.h"
+#include "vtime.h"
 #include "obfoo.h"
 #include "thread.h"
 #include "base64.h"
@@ -36,6 +38,15 @@
 #include "constants.h"
 #include "bev_splice.h"
 #include "hash_table.h"
+#include "load.h"
+#include "metrics.h"
+#include "histogram.h"
+#include "timeline.h"
+#include "trace.h"
+#include "peer.h"
+#include "probes.h"
+#include "cost.h"
+#include "arena.h"
 #include "utp_bufferevent.h"
 
 #ifdef ANDROID
@@ -58,42 +69,26 @@ typedef struct {
 } PACKED packed_ipv6;
 static_assert(sizeof(packed_ipv4) == 6, "packed_ipv6 should be 18 bytes");
 
-typedef struct {
-    sockaddr_storage addr;
-    time_t last_verified;
-    time_t last_connect;
-    time_t last_connect_attempt;
-    char via;
-    uint8_t loop;
-} peer;
-
 typedef struct {
     network *n;
     peer *peer;
     bufferevent *bev;
     evhttp_connection *evcon;
+    uint64_t connect_start;
 } peer_connection;
 
-typedef struct {
-    bool failed:1;
-    int64_t last_connect_attempt;
-    int64_t time_since_verified;
-    bool never_connected:1;
-    uint8_t loop;
-    uint8_t salt;
-    peer *peer;
-} PACKED peer_sort;
-
 #define CACHE_PATH "./cache/"
 #define CACHE_NAME CACHE_PATH "cache.XXXXXXXX"
 
-typedef bool (^peer_filter)(peer *p);
-typedef void (^peer_connected)(peer_connection *p);
-typedef struct pending_request {
+typedef struct pending_request pending_request;
+// a function rather than a block, so queueing a request doesn't allocate. the owner of r
+// is found with container_of()
+typedef void (*peer_connected)(pending_request *r, peer_connection *pc);
+struct pending_request {
     char *via;
     peer_connected on_connect;
     TAILQ_ENTRY(pending_request) next;
-} pending_request;
+};
 
 struct proxy_request;
 typedef struct proxy_request proxy_request;
@@ -103,6 +98,10 @@ typedef struct {
     uint64_t end;
     uint64_t chunk_index;
     evbuffer *chunk_buffer;
+    // verified bytes accepted from this slot
+    uint64_t bytes;
+    // end of the last timeline span on this slot
+    uint64_t span_start;
 } chunked_range;
 
 typedef struct {
@@ -118,10 +117,16 @@ typedef struct {
     evhttp_connection *evcon;
     proxy_request *p;
     chunked_range range;
+    // set while a new connection is being made, see direct_connect_cb()
+    evbuffer_cb_entry *connect_cb;
+    bufferevent *connect_bev;
+    uint64_t connect_start;
 } direct_request;
 
 struct proxy_request {
     network *n;
+    // p itself and its strings
+    arena *arena;
 
     evhttp_request *server_req;
     uint64 start_time;
@@ -136,6 +141,8 @@ struct proxy_request {
 
     int direct_code;
     char *direct_code_line;
+    // the status sent to the browser, 0 until one is
+    int response_code;
     evkeyvalq direct_headers;
     evkeyvalq output_headers;
 
@@ -146,6 +153,9 @@ struct proxy_request {
 
     uint64_t range_start;
     uint64_t range_end;
+    // the Range the browser sent, for the trace. range_end above becomes the end of the body
+    bool browser_range;
+    uint64_t browser_range_end;
 
     char cache_name[sizeof(CACHE_NAME)];
     int cache_file;
@@ -155,18 +165,26 @@ struct proxy_request {
     uint64_t total_length;
     uint64_t byte_playhead;
     bool *have_bitfield;
+    uint64_t have_chunks;
+
+    uint64_t bytes_direct;
+    uint64_t bytes_peer;
+    uint64_t bytes_injector;
+
+    // nonzero when recording a timeline
+    uint64_t timeline_id;
+
+    request_cost cost;
+
+    TAILQ_ENTRY(proxy_request) next;
 
     bool chunked:1;
     bool merkle_tree_finished:1;
     bool dont_free:1;
     bool localhost:1;
+    bool completed:1;
 };
 
-typedef struct {
-    uint length;
-    peer *peers[];
-} peer_array;
-
 typedef struct {
     uint64_t from_browser;
     uint64_t to_browser;
@@ -178,11 +196,78 @@ typedef struct {
     uint64_t to_p2p;
 } byte_counts;
 
+typedef struct {
+    uint64_t *pending;
+    uint64_t *total;
+} byte_counter;
+
+typedef struct {
+    // zeroed each time they are reported
+    byte_counts pending;
+    // never reset, for /metrics
+    byte_counts total;
+    // byte_count_cb() args, each bumps the same field of pending and total
+    byte_counter from_browser;
+    byte_counter to_browser;
+    byte_counter from_peer;
+    byte_counter to_peer;
+    byte_counter from_direct;
+    byte_counter to_direct;
+    byte_counter from_p2p;
+    byte_counter to_p2p;
+} authority_byte_counts;
+
 hash_table *byte_count_per_authority;
+hash_table *cost_per_authority;
 timer *stats_report_timer;
 network *g_n;
 uint64_t g_cid;
 bool g_stats_changed;
+bool g_bytes_counted;
+uint64_t g_cache_hits;
+uint64_t g_cache_not_modified;
+uint64_t g_cache_misses;
+uint64_t g_signatures_verified;
+uint64_t g_signature_cache_hits;
+
+typedef enum {
+    SWARM_INJECTOR,
+    SWARM_INJECTOR_PROXY,
+    SWARM_URL,
+} swarm_type;
+const char *swarm_names[] = {"injector", "injector_proxy", "url"};
+uint64_t g_swarm_peers_found[lenof(swarm_names)];
+
+typedef enum {
+    SOURCE_DIRECT,
+    SOURCE_PEER,
+    SOURCE_INJECTOR,
+    SOURCE_MIXED,
+    SOURCE_CACHE,
+} source_type;
+const char *source_names[] = {"direct", "peer", "injector", "mixed", "cache"};
+
+// phase latencies in microseconds. DNS is resolved inside libevent's connect,
+// so it is part of the direct connect and time to first byte.
+histogram g_connect_latency[SOURCE_INJECTOR + 1];
+histogram g_first_byte_latency[SOURCE_INJECTOR + 1];
+histogram g_verify_latency[SOURCE_INJECTOR + 1];
+histogram g_complete_latency[lenof(source_names)];
+
+// startup milestones, in microseconds from client_init(). 0 until reached
+typedef enum {
+    STARTUP_NETWORK,
+    STARTUP_LISTENING,
+    STARTUP_PEERS_LOADED,
+    STARTUP_FIRST_REQUEST,
+    STARTUP_FIRST_RESPONSE,
+    STARTUP_INJECTOR_CONNECTED,
+    STARTUP_INJECTOR_FOUND,
+} startup_phase;
+const char *startup_names[] = {"network", "listening", "peers_loaded", "first_request", "first_response",
+                               "injector_connected", "injector_found"};
+uint64_t g_startup_time;
+uint64_t g_startup[lenof(startup_names)];
 
 peer_array *injectors;
 peer_array *injector_proxies;
@@ -193,7 +278,7 @@ peer_connection *peer_connections[20];
 char via_tag[] = "1.1 _.newnode";
 time_t injector_reachable;
 time_t last_request;
-timer *saving_peers;
+timer saving_peers;
 uint16_t g_http_port;
 uint16_t g_socks_port;
 const char *g_app_name;
@@ -211,14 +296,24 @@ uint8_t encrypted_injector_proxy_swarm_p1[20];
 size_t pending_requests_len;
 TAILQ_HEAD(, pending_request) pending_requests;
 
+// live requests, for /debug/requests
+TAILQ_HEAD(, proxy_request) live_proxy_requests = TAILQ_HEAD_INITIALIZER(live_proxy_requests);
+
 
 void save_peers(network *n);
 
 uint64_t us_clock()
 {
-    timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+    return vtime_us();
+}
+
+void startup_reached(startup_phase phase)
+{
+    if (g_startup[phase]) {
+        return;
+    }
+    g_startup[phase] = MAX(us_clock() - g_startup_time, 1);
+    debug("startup %s after %.2fms\n", startup_names[phase], g_startup[phase] / 1000.0);
 }
 
 int mkpath(char *file_path)
@@ -238,12 +333,41 @@ int mkpath(char *file_path)
 
 bool peer_is_injector(peer *p)
 {
+    return p->array == &injectors;
+}
+
+void peer_load_reported(peer *p, evhttp_request *req)
+{
+    if (!peer_is_injector(p)) {
+        return;
+    }
+    load_report l;
+    if (!load_parse(evhttp_find_header(req->input_headers, LOAD_HEADER), &l)) {
+        return;
+    }
+    p->load = load_update(p->load, load_score(&l));
+    p->load_reported = vtime_time();
+    peer_updated(p);
+    debug("%s peer:%p load:%u active:%u queued:%u cpu:%u\n", __func__, p, p->load, l.active, l.queued, l.cpu);
+}
+
+bool peer_is_busy(peer *p)
+{
+    return p->load == LOAD_BUSY;
+}
+
+void decay_injector_load()
+{
+    // only injectors which haven't reported since the last tick
+    static time_t last_decay;
     for (uint i = 0; i < injectors->length; i++) {
-        if (injectors->peers[i] == p) {
-            return true;
+        peer *p = injectors->peers[i];
+        if (p->load_reported < last_decay) {
+            p->load /= 2;
         }
     }
-    return false;
+    last_decay = vtime_time();
+    peer_array_reorder(injectors);
 }
 
 void connect_more_injectors(network *n, bool injector_preference);
@@ -254,8 +378,7 @@ void pending_request_complete(pending_request *r, peer_connection *pc)
     free(r->via);
     r->via = NULL;
     r->on_connect = NULL;
-    on_connect(pc);
-    Block_release(on_connect);
+    on_connect(r, pc);
 }
 
 bool via_contains(const char *via, char v)
@@ -278,8 +401,17 @@ bool bufferevent_is_utp(bufferevent *bev)
     return ss.ss_family == AF_LOCAL;
 }
 
+source_type peer_source(peer *p)
+{
+    return peer_is_injector(p) ? SOURCE_INJECTOR : SOURCE_PEER;
+}
+
 void on_utp_connect(network *n, peer_connection *pc)
 {
+    histogram_record(&g_connect_latency[peer_source(pc->peer)], us_clock() - pc->connect_start);
+    if (peer_is_injector(pc->peer)) {
+        startup_reached(STARTUP_INJECTOR_CONNECTED);
+    }
     const sockaddr *ss = (const sockaddr *)&pc->peer->addr;
     char host[NI_MAXHOST];
     getnameinfo(ss, sockaddr_get_length(ss), host, sizeof(host), NULL, 0, NI_NUMERICHOST);
@@ -336,7 +468,7 @@ void bev_event_cb(bufferevent *bufev, short events, void *arg)
         }
         assert(!pc->evcon);
         pending_request *r = TAILQ_FIRST(&pending_requests);
-        if (r && time(NULL) - last_request < 30) {
+        if (r && vtime_time() - last_request < 30) {
             connect_more_injectors(pc->n, false);
         }
         free(pc);
@@ -345,44 +477,29 @@ void bev_event_cb(bufferevent *bufev, short events, void *arg)
     }
 }
 
-const char* peer_addr_str(const peer *p)
-{
-    return sockaddr_str((const sockaddr *)&p->addr);
-}
-
 peer_connection* evhttp_utp_connect(network *n, peer *p)
 {
     utp_socket *s = utp_create_socket(n->utp);
     debug("evhttp_utp_connect %s\n", peer_addr_str(p));
-    p->last_connect_attempt = time(NULL);
+    p->last_connect_attempt = vtime_time();
+    peer_updated(p);
     peer_connection *pc = alloc(peer_connection);
     pc->n = n;
     pc->peer = p;
+    pc->connect_start = us_clock();
     pc->bev = utp_socket_create_bev(n->evbase, s);
+    PROBE2(utp_connect, s, &p->addr);
     utp_connect(s, (const sockaddr*)&p->addr, sockaddr_get_length((const sockaddr*)&p->addr));
     bufferevent_setcb(pc->bev, NULL, NULL, bev_event_cb, pc);
     bufferevent_enable(pc->bev, EV_READ);
     return pc;
 }
 
-peer* get_peer(peer_array *pa, const sockaddr *a, socklen_t alen)
+void add_peer(network *n, peer_array **pa, peer *p)
 {
-    for (uint i = 0; i < pa->length; i++) {
-        peer *p = pa->peers[i];
-        if (a->sa_family == p->addr.ss_family && memeq(a, (const uint8_t *)&p->addr, alen)) {
-            return p;
-        }
-    }
-    return NULL;
-}
+    peer_array_add(pa, p);
 
-void add_peer(peer_array **pa, peer *p)
-{
-    (*pa)->length++;
-    *pa = realloc(*pa, sizeof(peer_array) + (*pa)->length * sizeof(peer*));
-    (*pa)->peers[(*pa)->length - 1] = p;
-
-    dht_ping_node((const sockaddr *)&p->addr, sockaddr_get_length((const sockaddr *)&p->addr));
+    dht_ping_later(n->dht, (const sockaddr *)&p->addr, sockaddr_get_length((const sockaddr *)&p->addr));
 }
 
 void add_address(network *n, peer_array **pa, const sockaddr *addr, socklen_t addrlen)
@@ -398,7 +515,7 @@ void add_address(network *n, peer_array **pa, const sockaddr *addr, socklen_t ad
     }
     p = alloc(peer);
     memcpy(&p->addr, addr, addrlen);
-    add_peer(pa, p);
+    add_peer(n, pa, p);
 
     const char *label = "peer";
     if (*pa == injectors) {
@@ -482,21 +599,31 @@ void dht_event_callback(void *closure, int event, const unsigned char *info_hash
     debug("dht_event_callback event:%d\n", event);
 
     peer_array **peer_list = NULL;
+    swarm_type swarm;
 
     if (memeq(info_hash, encrypted_injector_swarm_m1, sizeof(encrypted_injector_swarm_m1)) ||
         memeq(info_hash, encrypted_injector_swarm_p0, sizeof(encrypted_injector_swarm_p0)) ||
         memeq(info_hash, encrypted_injector_swarm_p1, sizeof(encrypted_injector_swarm_p1))) {
         peer_list = &injectors;
+        swarm = SWARM_INJECTOR;
     } else if (memeq(info_hash, encrypted_injector_proxy_swarm_m1, sizeof(encrypted_injector_proxy_swarm_m1)) ||
                memeq(info_hash, encrypted_injector_proxy_swarm_p0, sizeof(encrypted_injector_proxy_swarm_p0)) ||
                memeq(info_hash, encrypted_injector_proxy_swarm_p1, sizeof(encrypted_injector_proxy_swarm_p1))) {
         peer_list = &injector_proxies;
+        swarm = SWARM_INJECTOR_PROXY;
     } else {
         peer_list = &all_peers;
+        swarm = SWARM_URL;
     }
 
     const uint8_t* peers = data;
     size_t num_peers = data_len / (event == DHT_EVENT_VALUES ? sizeof(packed_ipv4) : sizeof(packed_ipv6));
+    if (event == DHT_EVENT_VALUES || event == DHT_EVENT_VALUES6) {
+        g_swarm_peers_found[swarm] += num_peers;
+        if (swarm == SWARM_INJECTOR && num_peers) {
+            startup_reached(STARTUP_INJECTOR_FOUND);
+        }
+    }
 
     if (o_debug >= 2) {
         printf("{\"");
@@ -521,7 +648,7 @@ void dht_event_callback(void *closure, int event, const unsigned char *info_hash
 
 void update_injector_proxy_swarm(network *n)
 {
-    time_t t = time(NULL);
+    time_t t = vtime_time();
     tm *tm = gmtime(&t);
     char name[1024];
 
@@ -556,7 +683,6 @@ void abort_connect(pending_request *r)
     debug("aborting request:%p\n", r);
     free(r->via);
     r->via = NULL;
-    Block_release(r->on_connect);
     r->on_connect = NULL;
     TAILQ_REMOVE(&pending_requests, r, next);
     pending_requests_len--;
@@ -581,8 +707,10 @@ void proxy_cache_delete(proxy_request *p)
 {
     if (p->cache_file != -1) {
         close(p->cache_file);
+        p->cost.cache_syscalls++;
         p->cache_file = -1;
         unlink(p->cache_name);
+        p->cost.cache_syscalls++;
     }
 }
 
@@ -611,6 +739,93 @@ double pdelta(proxy_request *p)
     return (double)(us_clock() - p->start_time) / 1000.0;
 }
 
+// timeline threads: 0 is the request itself, then direct slots, then peer slots
+uint64_t direct_slot(const direct_request *d)
+{
+    return 1 + (uint64_t)(d - d->p->direct_requests);
+}
+
+uint64_t peer_slot(const peer_request *r)
+{
+    return 1 + lenof(r->p->direct_requests) + (uint64_t)(r - r->p->requests);
+}
+
+void proxy_span(proxy_request *p, uint64_t slot, const char *name, uint64_t start)
+{
+    if (p->timeline_id) {
+        timeline_span(p->timeline_id, slot, name, start, us_clock());
+    }
+}
+
+void proxy_instant(proxy_request *p, uint64_t slot, const char *name)
+{
+    if (p->timeline_id) {
+        timeline_instant(p->timeline_id, slot, name, us_clock());
+    }
+}
+
+void proxy_chunk_span(proxy_request *p, uint64_t slot, chunked_range *r)
+{
+    if (!p->timeline_id) {
+        return;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "chunk %"PRIu64, r->chunk_index);
+    uint64_t now = us_clock();
+    timeline_span(p->timeline_id, slot, name, r->span_start, now);
+    r->span_start = now;
+}
+
+void proxy_cost_write(proxy_request *p, size_t length)
+{
+    p->cost.disk_writes++;
+    p->cost.disk_bytes += length;
+}
+
+void proxy_cost_merkle_tree(proxy_request *p, const merkle_tree *m)
+{
+    p->cost.bytes_hashed += m->bytes_hashed;
+    p->cost.allocations += m->allocations;
+}
+
+void proxy_cost_buffered(proxy_request *p)
+{
+    uint64_t buffered = 0;
+    for (size_t i = 0; i < lenof(p->direct_requests); i++) {
+        const chunked_range *r = &p->direct_requests[i].range;
+        buffered += r->chunk_buffer ? evbuffer_get_length(r->chunk_buffer) : 0;
+    }
+    for (size_t i = 0; i < lenof(p->requests); i++) {
+        const chunked_range *r = &p->requests[i].range;
+        buffered += r->chunk_buffer ? evbuffer_get_length(r->chunk_buffer) : 0;
+    }
+    if (p->server_req && p->server_req->evcon) {
+        buffered += evbuffer_get_length(bufferevent_get_output(evhttp_connection_get_bufferevent(p->server_req->evcon)));
+    }
+    cost_buffered(&p->cost, buffered);
+}
+
+source_type proxy_source(const proxy_request *p)
+{
+    if (!p->bytes_peer && !p->bytes_injector) {
+        return SOURCE_DIRECT;
+    }
+    if (!p->bytes_direct && !p->bytes_injector) {
+        return SOURCE_PEER;
+    }
+    if (!p->bytes_direct && !p->bytes_peer) {
+        return SOURCE_INJECTOR;
+    }
+    return SOURCE_MIXED;
+}
+
+void proxy_request_complete(proxy_request *p)
+{
+    proxy_instant(p, 0, "finish");
+    p->completed = true;
+    histogram_record(&g_complete_latency[proxy_source(p)], us_clock() - p->start_time);
+}
+
 void proxy_send_error(proxy_request *p, int error, const char *reason)
 {
     if (proxy_request_any_direct(p) || proxy_request_any_peers(p)) {
@@ -629,6 +844,7 @@ void proxy_send_error(proxy_request *p, int error, const char *reason)
                   p, p->server_req, p->server_req->evcon, pdelta(p),
                   error, reason);
             evhttp_send_error(p->server_req, error, reason);
+            p->response_code = error;
         }
         p->server_req = NULL;
     }
@@ -676,19 +892,32 @@ void proxy_request_cleanup(proxy_request *p, const char *reason)
             d->range.chunk_buffer = NULL;
         }
     }
-    free(p->direct_code_line);
     evhttp_clear_headers(&p->direct_headers);
     evhttp_clear_headers(&p->output_headers);
     if (p->header_buf) {
         evbuffer_free(p->header_buf);
     }
+    proxy_cost_merkle_tree(p, p->m);
     merkle_tree_free(p->m);
     free(p->have_bitfield);
     proxy_cache_delete(p);
-    free(p->authority);
-    free(p->etag);
-    free(p->uri);
-    free(p);
+    p->cost.allocations += arena_mallocs(p->arena);
+    char cost[512];
+    cost_format(&p->cost, cost, sizeof(cost));
+    debug("p:%p (%.2fms) cost %s %s\n", p, pdelta(p), cost, p->uri);
+    cost_account(&cost_per_authority, p->authority, &p->cost);
+    trace_record(p->start_time, us_clock(), evhttp_method(p->http_method), p->response_code,
+                 p->bytes_direct + p->bytes_peer + p->bytes_injector,
+                 p->completed ? source_names[proxy_source(p)] : "error",
+                 p->browser_range, p->range_start, p->browser_range_end, p->uri);
+    if (p->timeline_id) {
+        char name[128];
+        snprintf(name, sizeof(name), "request (%s)", reason);
+        proxy_span(p, 0, name, p->start_time);
+        timeline_flush();
+    }
+    TAILQ_REMOVE(&live_proxy_requests, p, next);
+    arena_free(p->arena);
 }
 
 void peer_request_cleanup(peer_request *r, const char *reason)
@@ -743,8 +972,32 @@ void peer_reuse(network *n, peer_connection *pc)
     peer_disconnect(pc);
 }
 
+void direct_connect_stop(direct_request *d)
+{
+    if (d->connect_cb) {
+        evbuffer_remove_cb_entry(bufferevent_get_output(d->connect_bev), d->connect_cb);
+        d->connect_cb = NULL;
+        d->connect_bev = NULL;
+    }
+}
+
+void direct_connect_cb(evbuffer *buf, const evbuffer_cb_info *info, void *userdata)
+{
+    direct_request *d = (direct_request*)userdata;
+    if (!info->n_deleted) {
+        return;
+    }
+    // the request is only written once the connection is up. a failed connection
+    // drains it too, but only after evhttp has closed the fd
+    if (bufferevent_getfd(d->connect_bev) != -1) {
+        histogram_record(&g_connect_latency[SOURCE_DIRECT], us_clock() - d->connect_start);
+    }
+    direct_connect_stop(d);
+}
+
 void direct_request_cancel(direct_request *d)
 {
+    direct_connect_stop(d);
     if (d->req) {
         evhttp_cancel_request(d->req);
         d->req = NULL;
@@ -835,6 +1088,19 @@ uint64_t num_chunks(const proxy_request *p)
     return DIV_ROUND_UP(p->total_length, LEAF_CHUNK_SIZE);
 }
 
+void proxy_resize_have_bitfield(proxy_request *p)
+{
+    // chunked responses grow this a chunk at a time, so it stays on the heap where realloc is
+    // amortized. never 0 bytes, or an empty body would look like no bitfield at all
+    uint64_t chunks = num_chunks(p);
+    p->have_bitfield = realloc(p->have_bitfield, MAX(chunks, 1));
+    p->cost.allocations++;
+    if (chunks > p->have_chunks) {
+        memset(&p->have_bitfield[p->have_chunks], 0, chunks - p->have_chunks);
+    }
+    p->have_chunks = chunks;
+}
+
 uint64_t chunk_length(const proxy_request *p, uint64_t chunk_index)
 {
     if (p->chunked) {
@@ -856,12 +1122,13 @@ int proxy_setup_range(proxy_request *p, evhttp_request *req, chunked_range *rang
         snprintf(p->cache_name, sizeof(p->cache_name), CACHE_NAME);
         mkpath(p->cache_name);
         p->cache_file = mkstemp(p->cache_name);
+        p->cost.cache_syscalls++;
         debug("start cache:%s\n", p->cache_name);
     }
 
     if (!p->etag) {
         const char *etag = evhttp_find_header(req->input_headers, "ETag");
-        p->etag = etag?strdup(etag):NULL;
+        p->etag = etag?arena_strdup(p->arena, etag):NULL;
     }
 
     uint64_t total_length = 0;
@@ -898,8 +1165,9 @@ int proxy_setup_range(proxy_request *p, evhttp_request *req, chunked_range *rang
             code = 200;
         }
         p->direct_code = code;
-        p->direct_code_line = strdup(req->response_code_line);
+        p->direct_code_line = arena_strdup(p->arena, req->response_code_line);
         p->header_buf = build_request_buffer(code, req->input_headers);
+        p->cost.allocations++;
         uint64_t header_prefix = p->header_buf ? evbuffer_get_length(p->header_buf) : 0;
         range->chunk_index = (range->start + header_prefix) / LEAF_CHUNK_SIZE;
     }
@@ -928,7 +1196,7 @@ int proxy_setup_range(proxy_request *p, evhttp_request *req, chunked_range *rang
     p->total_length = total_length;
 
     if (!p->have_bitfield) {
-        p->have_bitfield = calloc(1, num_chunks(p));
+        proxy_resize_have_bitfield(p);
     }
 
     return 1;
@@ -939,6 +1207,10 @@ int direct_header_cb(evhttp_request *req, void *arg)
     direct_request *d = (direct_request*)arg;
     proxy_request *p = d->p;
     debug("d:%p (%.2fms) direct_header_cb %d %s %s\n", d, pdelta(p), req->response_code, req->response_code_line, p->uri);
+    direct_connect_stop(d);
+    histogram_record(&g_first_byte_latency[SOURCE_DIRECT], us_clock() - p->start_time);
+    proxy_span(p, direct_slot(d), "connect+headers", d->range.span_start);
+    d->range.span_start = us_clock();
 
     // "416 Range Not Satisfiable" means we can't use additional connections at all.
     if (req->response_code == 416) {
@@ -1095,6 +1367,43 @@ void proxy_request_reply_start(proxy_request *p, evhttp_request *req)
         }
         evhttp_send_reply_start(p->server_req, req->response_code, req->response_code_line);
     }
+    startup_reached(STARTUP_FIRST_RESPONSE);
+    p->response_code = p->server_req->response_code;
+}
+
+void direct_request_finished(direct_request *d, evhttp_request *req)
+{
+    proxy_request *p = d->p;
+    if (p->server_req) {
+        proxy_request_complete(p);
+        if (p->server_req->evcon) {
+            evhttp_connection_set_closecb(p->server_req->evcon, NULL, NULL);
+        }
+        evhttp_send_reply_end(p->server_req);
+        p->server_req = NULL;
+        proxy_direct_requests_cancel(p);
+    }
+
+    //join_url_swarm(p->n, uri);
+    evhttp_uri *evuri = evhttp_uri_parse_with_flags(req->uri, EVHTTP_URI_NONCONFORMANT);
+    const char *host = evhttp_uri_get_host(evuri);
+    if (host) {
+        join_url_swarm(p->n, host);
+    }
+    evhttp_uri_free(evuri);
+
+    merkle_tree_get_root(p->m, p->root_hash);
+
+    // submit a proxy-only request with If-None-Match: "base64(root_hash)" and let it cache
+    size_t b64_hash_len;
+    char *b64_hash = base64_urlsafe_encode((uint8_t*)&p->root_hash, sizeof(p->root_hash), &b64_hash_len);
+    char etag[2048];
+    snprintf(etag, sizeof(etag), "\"%s\"", b64_hash);
+    free(b64_hash);
+    debug("d:%p submitting a cache request %s\n", d, etag);
+    evhttp_add_header(&p->output_headers, "If-None-Match", etag);
+
+    proxy_submit_request(p);
 }
 
 bool direct_request_process_chunks(direct_request *d, evhttp_request *req)
@@ -1103,12 +1412,18 @@ bool direct_request_process_chunks(direct_request *d, evhttp_request *req)
     chunked_range *r = &d->range;
     evbuffer *input = req->input_buffer;
     debug("d:%p %s length:%zu\n", d, __func__, evbuffer_get_length(input));
+    proxy_cost_buffered(p);
 
     if (!r->chunk_buffer) {
         r->chunk_buffer = evbuffer_new();
+        p->cost.allocations++;
     }
 
     for (;;) {
+        if (!p->chunked && r->chunk_index && r->chunk_index >= num_chunks(p)) {
+            // every chunk is in already
+            return true;
+        }
         uint64_t this_chunk_len = chunk_length(p, r->chunk_index);
 
         uint64_t header_prefix = 0;
@@ -1126,9 +1441,13 @@ bool direct_request_process_chunks(direct_request *d, evhttp_request *req)
 
         if (p->have_bitfield[r->chunk_index]) {
             debug("d:%p duplicate chunk:%"PRIu64"\n", d, r->chunk_index);
+            proxy_chunk_span(p, direct_slot(d), r);
         } else {
             debug("d:%p got chunk:%"PRIu64"\n", d, r->chunk_index);
             p->have_bitfield[r->chunk_index] = true;
+            r->bytes += this_chunk_len - header_prefix;
+            p->bytes_direct += this_chunk_len - header_prefix;
+            proxy_chunk_span(p, direct_slot(d), r);
 
             crypto_generichash_state content_state;
             crypto_generichash_init(&content_state, NULL, 0, crypto_generichash_BYTES);
@@ -1137,6 +1456,7 @@ bool direct_request_process_chunks(direct_request *d, evhttp_request *req)
                 evbuffer_hash_update(p->header_buf, &content_state);
             }
             evbuffer_hash_update(r->chunk_buffer, &content_state);
+            p->cost.bytes_hashed += this_chunk_len;
 
             uint8_t chunk_hash[crypto_generichash_BYTES];
             crypto_generichash_final(&content_state, chunk_hash, sizeof(chunk_hash));
@@ -1149,7 +1469,11 @@ bool direct_request_process_chunks(direct_request *d, evhttp_request *req)
                     this_chunk_offset -= evbuffer_get_length(p->header_buf);
                 }
                 debug("d:%p writing offset:%"PRIu64" length:%zu\n", d, this_chunk_offset, evbuffer_get_length(r->chunk_buffer));
+                proxy_cost_write(p, evbuffer_get_length(r->chunk_buffer));
                 lseek(p->cache_file, this_chunk_offset, SEEK_SET);
+                p->cost.cache_syscalls++;
+                // evbuffer_write_to_file() is one writev
+                p->cost.cache_syscalls++;
                 if (!evbuffer_write_to_file(r->chunk_buffer, p->cache_file)) {
                     return false;
                 }
@@ -1181,6 +1505,7 @@ bool direct_request_process_chunks(direct_request *d, evhttp_request *req)
             uint64_t length = c - p->byte_playhead;
             debug("d:%p sending offset:%"PRIu64" length:%"PRIu64"\n", d, (uint64_t)offset, length);
             evbuffer_file_segment *seg = evbuffer_file_segment_new(p->cache_file, offset, length, 0);
+            p->cost.cache_syscalls++;
             if (!seg) {
                 fprintf(stderr, "d:%p evbuffer_file_segment_new %d (%s)\n", d, errno, strerror(errno));
                 return false;
@@ -1198,41 +1523,13 @@ bool direct_request_process_chunks(direct_request *d, evhttp_request *req)
 
         debug("d:%p progress p->byte_playhead:%"PRIu64" p->total_length:%"PRIu64"\n", d, p->byte_playhead, p->total_length);
         if (!p->chunked && p->byte_playhead == p->total_length) {
-            if (p->server_req) {
-                if (p->server_req->evcon) {
-                    evhttp_connection_set_closecb(p->server_req->evcon, NULL, NULL);
-                }
-                evhttp_send_reply_end(p->server_req);
-                p->server_req = NULL;
-                proxy_direct_requests_cancel(p);
-            }
-
-            //join_url_swarm(p->n, uri);
-            evhttp_uri *evuri = evhttp_uri_parse_with_flags(req->uri, EVHTTP_URI_NONCONFORMANT);
-            const char *host = evhttp_uri_get_host(evuri);
-            if (host) {
-                join_url_swarm(p->n, host);
-            }
-            evhttp_uri_free(evuri);
-
-            merkle_tree_get_root(p->m, p->root_hash);
-
-            // submit a proxy-only request with If-None-Match: "base64(root_hash)" and let it cache
-            size_t b64_hash_len;
-            char *b64_hash = base64_urlsafe_encode((uint8_t*)&p->root_hash, sizeof(p->root_hash), &b64_hash_len);
-            char etag[2048];
-            snprintf(etag, sizeof(etag), "\"%s\"", b64_hash);
-            free(b64_hash);
-            debug("d:%p submitting a cache request %s\n", d, etag);
-            evhttp_add_header(&p->output_headers, "If-None-Match", etag);
-
-            proxy_submit_request(p);
+            direct_request_finished(d, req);
             return true;
         }
 
         if (p->chunked) {
             p->total_length = p->byte_playhead;
-            p->have_bitfield = realloc(p->have_bitfield, num_chunks(p));
+            proxy_resize_have_bitfield(p);
             continue;
         }
 
@@ -1273,6 +1570,8 @@ void direct_error_cb(evhttp_request_error error, void *arg)
     direct_request *d = (direct_request*)arg;
     proxy_request *p = d->p;
     debug("d:%p direct_error_cb %d %s\n", d, error, evhttp_request_error_str(error));
+    proxy_instant(p, direct_slot(d), evhttp_request_error_str(error));
+    direct_connect_stop(d);
     assert(d->req);
     d->req = NULL;
     if (error == EVREQ_HTTP_REQUEST_CANCEL) {
@@ -1285,6 +1584,7 @@ void direct_request_done_cb(evhttp_request *req, void *arg)
 {
     direct_request *d = (direct_request*)arg;
     debug("d:%p %s req:%p\n", d, __func__, req);
+    direct_connect_stop(d);
     if (!req) {
         return;
     }
@@ -1292,6 +1592,7 @@ void direct_request_done_cb(evhttp_request *req, void *arg)
     debug("p:%p d:%p (%.2fms) %s %s\n", p, d, pdelta(p), __func__, p->uri);
     d->req = NULL;
 
+    bool chunked = p->chunked;
     if (p->chunked) {
         size_t buffered = d->range.chunk_buffer ? evbuffer_get_length(d->range.chunk_buffer) : 0;
         if (!d->range.chunk_index) {
@@ -1299,13 +1600,19 @@ void direct_request_done_cb(evhttp_request *req, void *arg)
         } else {
             p->total_length = p->byte_playhead + buffered;
         }
-        p->have_bitfield = realloc(p->have_bitfield, num_chunks(p));
+        proxy_resize_have_bitfield(p);
         p->chunked = false;
     }
 
     if (req->response_code != 0) {
-        // there may have been no chunks, or a chunked transfer of unknown length. call the chunked_cb one last time
-        direct_request_process_chunks(d, req);
+        if (chunked && d->range.chunk_index && d->range.chunk_index == num_chunks(p)) {
+            // the body ended on a chunk boundary, so all of it went out while its length was
+            // unknown and there is no last chunk to process
+            direct_request_finished(d, req);
+        } else {
+            // there may have been no chunks, or a chunked transfer of unknown length. call the chunked_cb one last time
+            direct_request_process_chunks(d, req);
+        }
 
         return_connection(d->evcon);
         d->evcon = NULL;
@@ -1321,8 +1628,40 @@ void direct_request_done_cb(evhttp_request *req, void *arg)
     }
 }
 
+// (content_hash, signature) pairs which already verified, keyed so entries can't be forced to collide
+#define SIGNATURE_CACHE_SIZE 1024
+uint8_t signature_cache[SIGNATURE_CACHE_SIZE][crypto_generichash_BYTES];
+uint8_t signature_cache_key[crypto_generichash_KEYBYTES];
+
+uint8_t* signature_cache_slot(const uint8_t *content_hash, const char *sign, uint8_t *digest)
+{
+    static bool keyed = false;
+    if (!keyed) {
+        randombytes_buf(signature_cache_key, sizeof(signature_cache_key));
+        keyed = true;
+    }
+    crypto_generichash_state state;
+    crypto_generichash_init(&state, signature_cache_key, sizeof(signature_cache_key), crypto_generichash_BYTES);
+    crypto_generichash_update(&state, content_hash, crypto_generichash_BYTES);
+    crypto_generichash_update(&state, (const uint8_t *)sign, strlen(sign));
+    crypto_generichash_final(&state, digest, crypto_generichash_BYTES);
+    uint32_t index;
+    memcpy(&index, digest, sizeof(index));
+    return signature_cache[index % SIGNATURE_CACHE_SIZE];
+}
+
 bool verify_signature(const uint8_t *content_hash, const char *sign)
 {
+    uint8_t digest[crypto_generichash_BYTES];
+    uint8_t *slot = signature_cache_slot(content_hash, sign, digest);
+    if (memeq(slot, digest, sizeof(digest))) {
+        g_signature_cache_hits++;
+        PROBE2(signature_verify, content_hash, true);
+        return true;
+    }
+    g_signatures_verified++;
+    PROBE2(signature_verify, content_hash, false);
+
     if (strlen(sign) != BASE64_LENGTH(sizeof(content_sig))) {
         fprintf(stderr, "Incorrect length! %zu != %zu\n", strlen(sign), sizeof(content_sig));
         return false;
@@ -1360,6 +1699,7 @@ bool verify_signature(const uint8_t *content_hash, const char *sign)
     }
 
     free(raw_sig);
+    memcpy(slot, digest, sizeof(digest));
     return true;
 }
 
@@ -1367,25 +1707,98 @@ void peer_request_chunked_cb(evhttp_request *req, void *arg);
 
 void peer_verified(network *n, peer *peer)
 {
-    peer->last_verified = time(NULL);
+    peer->last_verified = vtime_time();
+    peer_updated(peer);
     save_peers(n);
     if (peer_is_injector(peer)) {
-        injector_reachable = time(NULL);
+        injector_reachable = vtime_time();
         update_injector_proxy_swarm(n);
     }
 }
 
+// signatures which only affect peer reputation, checked together off the request path
+#define VERIFY_BATCH_SIZE 64
+#define VERIFY_BATCH_DELAY_MS 5
+typedef struct {
+    uint8_t root_hash[crypto_generichash_BYTES];
+    char *sign;
+    peer *peer;
+} deferred_verify;
+deferred_verify verify_batch[VERIFY_BATCH_SIZE];
+uint verify_batch_len;
+timer verify_batch_timer;
+
+void verify_batch_drain(network *n)
+{
+    debug("%s len:%u\n", __func__, verify_batch_len);
+    for (uint i = 0; i < verify_batch_len; i++) {
+        deferred_verify *v = &verify_batch[i];
+        if (!v->sign) {
+            continue;
+        }
+        bool good = verify_signature(v->root_hash, v->sign);
+        // identical pairs share the result
+        for (uint j = i; j < verify_batch_len; j++) {
+            deferred_verify *o = &verify_batch[j];
+            if (!o->sign || !memeq(o->root_hash, v->root_hash, sizeof(v->root_hash)) || !streq(o->sign, v->sign)) {
+                continue;
+            }
+            if (good) {
+                peer_verified(n, o->peer);
+            } else {
+                fprintf(stderr, "deferred signature failed! %s\n", peer_addr_str(o->peer));
+                o->peer->last_verified = 0;
+                peer_updated(o->peer);
+            }
+            if (o != v) {
+                free(o->sign);
+                o->sign = NULL;
+            }
+        }
+        free(v->sign);
+        v->sign = NULL;
+    }
+    verify_batch_len = 0;
+}
+
+void verify_batch_cb(void *arg)
+{
+    verify_batch_drain((network*)arg);
+}
+
+void verify_deferred(network *n, peer *peer, const uint8_t *root_hash, const char *sign)
+{
+    if (verify_batch_len == lenof(verify_batch)) {
+        verify_batch_drain(n);
+    }
+    deferred_verify *v = &verify_batch[verify_batch_len++];
+    memcpy(v->root_hash, root_hash, sizeof(v->root_hash));
+    v->sign = strdup(sign);
+    v->peer = peer;
+    if (!timer_scheduled(&verify_batch_timer)) {
+        timer_schedule(&verify_batch_timer, VERIFY_BATCH_DELAY_MS);
+    }
+}
+
 void proxy_save_cache(proxy_request *p)
 {
+    uint64_t start = us_clock();
+    p->cost.disk_writes++;
     char headers_name[PATH_MAX];
     snprintf(headers_name, sizeof(headers_name), "%s.headers", p->cache_name);
     evkeyvalq *headers = &p->direct_headers;
     int headers_file = creat(headers_name, 0600);
+    p->cost.cache_syscalls++;
+    // write_header_to_file() is one writev
+    p->cost.cache_syscalls++;
     if (!write_header_to_file(headers_file, p->direct_code, p->direct_code_line, headers)) {
         unlink(headers_name);
+        p->cost.cache_syscalls++;
     }
     fsync(headers_file);
+    p->cost.cache_syscalls++;
     close(headers_file);
+    p->cost.cache_syscalls++;
 
     char *encoded_uri = cache_name_from_uri(p->uri);
     char cache_path[PATH_MAX];
@@ -1396,14 +1809,19 @@ void proxy_save_cache(proxy_request *p)
     debug("p:%p (%.2fms) store cache:%s headers:%s\n", p, pdelta(p), cache_path, cache_headers_path);
 
     fsync(p->cache_file);
+    p->cost.cache_syscalls++;
     rename(p->cache_name, cache_path);
+    p->cost.cache_syscalls++;
     rename(headers_name, cache_headers_path);
+    p->cost.cache_syscalls++;
+    proxy_span(p, 0, "cache write", start);
 }
 
 void peer_is_loop(peer *p)
 {
     debug("%s:%d peer:%p\n", __func__, __LINE__, p);
     p->loop++;
+    peer_updated(p);
     /*
     for (uint i = 0; i < lenof(peer_connections); i++) {
         if (peer_connections[i] && is_via) {
@@ -1414,11 +1832,40 @@ void peer_is_loop(peer *p)
     */
 }
 
+bool injector_is_busy(peer *p, evhttp_request *req)
+{
+    // injectors shed load with a signed 503
+    if (req->response_code != 503 || !peer_is_injector(p)) {
+        return false;
+    }
+    const char *msign = evhttp_find_header(req->input_headers, "X-MSign");
+    if (!msign) {
+        return false;
+    }
+    merkle_tree *m = alloc(merkle_tree);
+    merkle_tree_hash_request(m, req, req->input_headers);
+    uint8_t root_hash[crypto_generichash_BYTES];
+    merkle_tree_get_root(m, root_hash);
+    merkle_tree_free(m);
+    if (!verify_signature(root_hash, msign)) {
+        return false;
+    }
+    debug("%s peer:%p %s\n", __func__, p, peer_addr_str(p));
+    p->load = LOAD_BUSY;
+    p->load_reported = vtime_time();
+    peer_updated(p);
+    return true;
+}
+
 int peer_request_header_cb(evhttp_request *req, void *arg)
 {
     peer_request *r = (peer_request*)arg;
     proxy_request *p = r->p;
     debug("p:%p r:%p (%.2fms) %s %d %s\n", p, r, pdelta(p), __func__, req->response_code, req->response_code_line);
+    histogram_record(&g_first_byte_latency[peer_source(r->pc->peer)], us_clock() - p->start_time);
+    proxy_span(p, peer_slot(r), "headers", r->range.span_start);
+
+    peer_load_reported(r->pc->peer, req);
 
     int klass = req->response_code / 100;
     switch (klass) {
@@ -1431,6 +1878,8 @@ int peer_request_header_cb(evhttp_request *req, void *arg)
         if (req->response_code == 508) {
             peer_is_loop(r->pc->peer);
             proxy_submit_request(p);
+        } else if (injector_is_busy(r->pc->peer, req)) {
+            proxy_submit_request(p);
         }
         proxy_send_error(p, req->response_code, req->response_code_line);
     default:
@@ -1445,7 +1894,8 @@ int peer_request_header_cb(evhttp_request *req, void *arg)
     }
 
     // not the first moment of connection, but does indicate protocol support
-    r->pc->peer->last_connect = time(NULL);
+    r->pc->peer->last_connect = vtime_time();
+    peer_updated(r->pc->peer);
 
     debug("tree finished: %d\n", p->merkle_tree_finished);
 
@@ -1457,6 +1907,7 @@ int peer_request_header_cb(evhttp_request *req, void *arg)
         return -1;
     }
 
+    uint64_t verify_start = us_clock();
     if (!p->merkle_tree_finished) {
         const char *xhashes = evhttp_find_header(req->input_headers, "X-Hashes");
         if (!xhashes) {
@@ -1467,44 +1918,67 @@ int peer_request_header_cb(evhttp_request *req, void *arg)
         }
         size_t out_len = 0;
         uint8_t *hashes = base64_decode(xhashes, strlen(xhashes), &out_len);
+        p->cost.allocations++;
 
         merkle_tree *m = alloc(merkle_tree);
+        p->cost.allocations++;
         if (!merkle_tree_set_leaves(m, hashes, out_len)) {
             debug("merkle_tree_set_leaves failed: %zu\n", out_len);
             r->pc->peer->last_verified = 0;
+            peer_updated(r->pc->peer);
             proxy_send_error(p, 502, "Bad Gateway Hashes");
             free(hashes);
+            proxy_cost_merkle_tree(p, m);
             merkle_tree_free(m);
             return -1;
         }
         free(hashes);
         uint8_t root_hash[crypto_generichash_BYTES];
         merkle_tree_get_root(m, root_hash);
+        p->cost.signatures++;
         if (!verify_signature(root_hash, msign)) {
             fprintf(stderr, "signature failed!\n");
             r->pc->peer->last_verified = 0;
+            peer_updated(r->pc->peer);
             proxy_send_error(p, 502, "Bad Gateway Signature");
+            proxy_cost_merkle_tree(p, m);
             merkle_tree_free(m);
             return -1;
         }
         debug("signature good!\n");
+        // the verified tree replaces the one built from direct chunks
+        proxy_cost_merkle_tree(p, p->m);
+        merkle_tree_free(p->m);
         p->m = m;
         memcpy(p->root_hash, root_hash, sizeof(root_hash));
         p->merkle_tree_finished = true;
         overwrite_kv_header(&p->direct_headers, "X-Hashes", xhashes);
+    } else if (req->response_code != 304 && !streq(msign, evhttp_find_header(&p->direct_headers, "X-MSign") ?: "")) {
+        // every chunk is checked against the already verified tree, so this
+        // signature only matters for the peer's reputation. check it later, with others.
+        verify_deferred(p->n, r->pc->peer, p->root_hash, msign);
+        msign = NULL;
     } else {
+        p->cost.signatures++;
         if (!verify_signature(p->root_hash, msign)) {
             fprintf(stderr, "signature failed!\n");
             r->pc->peer->last_verified = 0;
+            peer_updated(r->pc->peer);
             proxy_send_error(p, 502, "Bad Gateway Signature");
             return -1;
         }
         debug("signature good!\n");
     }
 
-    overwrite_kv_header(&p->direct_headers, "X-MSign", msign);
+    histogram_record(&g_verify_latency[peer_source(r->pc->peer)], us_clock() - verify_start);
+    proxy_span(p, peer_slot(r), "verify", verify_start);
+    r->range.span_start = us_clock();
+
+    if (msign) {
+        overwrite_kv_header(&p->direct_headers, "X-MSign", msign);
+        peer_verified(p->n, r->pc->peer);
+    }
     overwrite_kv_header(&p->direct_headers, "Content-Location", content_location);
-    peer_verified(p->n, r->pc->peer);
 
     debug("tree finished: %d\n", p->merkle_tree_finished);
 
@@ -1518,6 +1992,7 @@ int peer_request_header_cb(evhttp_request *req, void *arg)
         proxy_cache_delete(p);
         free(p->have_bitfield);
         p->have_bitfield = NULL;
+        p->have_chunks = 0;
     }
 
     int res = proxy_setup_range(p, req, &r->range);
@@ -1534,9 +2009,11 @@ bool peer_request_process_chunks(peer_request *r, evhttp_request *req)
     proxy_request *p = r->p;
     evbuffer *input = req->input_buffer;
     debug("r:%p %s length:%zu\n", r, __func__, evbuffer_get_length(input));
+    proxy_cost_buffered(p);
 
     if (!r->range.chunk_buffer) {
         r->range.chunk_buffer = evbuffer_new();
+        p->cost.allocations++;
     }
 
     for (;;) {
@@ -1566,16 +2043,26 @@ bool peer_request_process_chunks(peer_request *r, evhttp_request *req)
             evbuffer_hash_update(p->header_buf, &content_state);
         }
         evbuffer_hash_update(r->range.chunk_buffer, &content_state);
+        p->cost.bytes_hashed += this_chunk_len;
 
         uint8_t chunk_hash[crypto_generichash_BYTES];
         crypto_generichash_final(&content_state, chunk_hash, sizeof(chunk_hash));
 
         if (!memeq(chunk_hash, p->m->nodes[r->range.chunk_index].hash, sizeof(chunk_hash))) {
             fprintf(stderr, "r:%p chunk:%"PRIu64" hash failed\n", r, r->range.chunk_index);
+            PROBE3(chunk_verify, p, r->range.chunk_index, false);
             return false;
         }
         debug("r:%p got chunk:%"PRIu64" hash success\n", r, r->range.chunk_index);
+        PROBE3(chunk_verify, p, r->range.chunk_index, true);
         p->have_bitfield[r->range.chunk_index] = true;
+        r->range.bytes += this_chunk_len - header_prefix;
+        proxy_chunk_span(p, peer_slot(r), &r->range);
+        if (peer_is_injector(r->pc->peer)) {
+            p->bytes_injector += this_chunk_len - header_prefix;
+        } else {
+            p->bytes_peer += this_chunk_len - header_prefix;
+        }
 
         peer_verified(p->n, r->pc->peer);
 
@@ -1584,7 +2071,11 @@ bool peer_request_process_chunks(peer_request *r, evhttp_request *req)
             if (r->range.chunk_index > 0) {
                 this_chunk_offset -= evbuffer_get_length(p->header_buf);
             }
+            proxy_cost_write(p, evbuffer_get_length(r->range.chunk_buffer));
             lseek(p->cache_file, this_chunk_offset, SEEK_SET);
+            p->cost.cache_syscalls++;
+            // evbuffer_write_to_file() is one writev
+            p->cost.cache_syscalls++;
             if (!evbuffer_write_to_file(r->range.chunk_buffer, p->cache_file)) {
                 return false;
             }
@@ -1619,6 +2110,7 @@ bool peer_request_process_chunks(peer_request *r, evhttp_request *req)
             off_t offset = p->byte_playhead - evbuffer_get_length(p->header_buf);
             uint64_t length = c - p->byte_playhead;
             evbuffer_file_segment *seg = evbuffer_file_segment_new(p->cache_file, offset, length, 0);
+            p->cost.cache_syscalls++;
             if (!seg) {
                 fprintf(stderr, "r:%p evbuffer_file_segment_new %d (%s)\n", r, errno, strerror(errno));
                 return false;
@@ -1637,6 +2129,7 @@ bool peer_request_process_chunks(peer_request *r, evhttp_request *req)
         debug("p->byte_playhead:%"PRIu64" p->total_length:%"PRIu64"\n", p->byte_playhead, p->total_length);
         if (p->byte_playhead == p->total_length) {
             if (p->server_req) {
+                proxy_request_complete(p);
                 if (p->server_req->evcon) {
                     evhttp_connection_set_closecb(p->server_req->evcon, NULL, NULL);
                 }
@@ -1699,6 +2192,7 @@ void peer_request_error_cb(evhttp_request_error error, void *arg)
 {
     peer_request *r = (peer_request*)arg;
     debug("r:%p %s %d %s\n", r, __func__, error, evhttp_request_error_str(error));
+    proxy_instant(r->p, peer_slot(r), evhttp_request_error_str(error));
     r->req = NULL;
     if (error == EVREQ_HTTP_REQUEST_CANCEL) {
         return;
@@ -1823,11 +2317,13 @@ void stats_changed()
 
 void byte_count_cb(evbuffer *buf, const evbuffer_cb_info *info, void *userdata)
 {
-    uint64_t *counter = (uint64_t*)userdata;
+    byte_counter *counter = (byte_counter*)userdata;
     //debug("%s counter:%p bytes:%zu\n", __func__, counter, info->n_deleted);
+    // this runs on every buffer movement; stats_changed() is left to the flush timer
     if (info->n_deleted) {
-        *counter += info->n_deleted;
-        stats_changed();
+        *counter->pending += info->n_deleted;
+        *counter->total += info->n_deleted;
+        g_bytes_counted = true;
     }
 }
 
@@ -1842,10 +2338,26 @@ void bufferevent_count_bytes(network *n, const char *authority, bool from_localh
 
     if (!byte_count_per_authority) {
         byte_count_per_authority = hash_table_create();
+        timer_repeating(n, 1000, ^{
+            if (g_bytes_counted) {
+                g_bytes_counted = false;
+                stats_changed();
+            }
+        });
+    }
+    authority_byte_counts *counts = hash_get(byte_count_per_authority, authority);
+    if (!counts) {
+        counts = alloc(authority_byte_counts);
+        counts->from_browser = (byte_counter){&counts->pending.from_browser, &counts->total.from_browser};
+        counts->to_browser = (byte_counter){&counts->pending.to_browser, &counts->total.to_browser};
+        counts->from_peer = (byte_counter){&counts->pending.from_peer, &counts->total.from_peer};
+        counts->to_peer = (byte_counter){&counts->pending.to_peer, &counts->total.to_peer};
+        counts->from_direct = (byte_counter){&counts->pending.from_direct, &counts->total.from_direct};
+        counts->to_direct = (byte_counter){&counts->pending.to_direct, &counts->total.to_direct};
+        counts->from_p2p = (byte_counter){&counts->pending.from_p2p, &counts->total.from_p2p};
+        counts->to_p2p = (byte_counter){&counts->pending.to_p2p, &counts->total.to_p2p};
+        hash_set(byte_count_per_authority, strdup(authority), counts);
     }
-    byte_counts *byte_count = hash_get_or_insert(byte_count_per_authority, strdup(authority), ^{
-        return alloc(byte_counts);
-    });
 
     // prevent double-counting by removing all previous byte counters
     if (from) {
@@ -1857,23 +2369,23 @@ void bufferevent_count_bytes(network *n, const char *authority, bool from_localh
 
     if (!from_localhost && bufferevent_is_utp(to)) {
         if (from) {
-            evbuffer_add_cb(bufferevent_get_input(from), byte_count_cb, &byte_count->from_p2p);
-            evbuffer_add_cb(bufferevent_get_output(from), byte_count_cb, &byte_count->to_p2p);
+            evbuffer_add_cb(bufferevent_get_input(from), byte_count_cb, &counts->from_p2p);
+            evbuffer_add_cb(bufferevent_get_output(from), byte_count_cb, &counts->to_p2p);
         }
-        evbuffer_add_cb(bufferevent_get_input(to), byte_count_cb, &byte_count->from_p2p);
-        evbuffer_add_cb(bufferevent_get_output(to), byte_count_cb, &byte_count->to_p2p);
+        evbuffer_add_cb(bufferevent_get_input(to), byte_count_cb, &counts->from_p2p);
+        evbuffer_add_cb(bufferevent_get_output(to), byte_count_cb, &counts->to_p2p);
         return;
     }
     if (from_localhost && from) {
-        evbuffer_add_cb(bufferevent_get_input(from), byte_count_cb, &byte_count->from_browser);
-        evbuffer_add_cb(bufferevent_get_output(from), byte_count_cb, &byte_count->to_browser);
+        evbuffer_add_cb(bufferevent_get_input(from), byte_count_cb, &counts->from_browser);
+        evbuffer_add_cb(bufferevent_get_output(from), byte_count_cb, &counts->to_browser);
     }
     if (bufferevent_is_utp(to)) {
-        evbuffer_add_cb(bufferevent_get_input(to), byte_count_cb, &byte_count->from_peer);
-        evbuffer_add_cb(bufferevent_get_output(to), byte_count_cb, &byte_count->to_peer);
+        evbuffer_add_cb(bufferevent_get_input(to), byte_count_cb, &counts->from_peer);
+        evbuffer_add_cb(bufferevent_get_output(to), byte_count_cb, &counts->to_peer);
     } else {
-        evbuffer_add_cb(bufferevent_get_input(to), byte_count_cb, &byte_count->from_direct);
-        evbuffer_add_cb(bufferevent_get_output(to), byte_count_cb, &byte_count->to_direct);
+        evbuffer_add_cb(bufferevent_get_input(to), byte_count_cb, &counts->from_direct);
+        evbuffer_add_cb(bufferevent_get_output(to), byte_count_cb, &counts->to_direct);
     }
 }
 
@@ -1897,6 +2409,8 @@ void direct_submit_request(proxy_request *p)
 
     d->p = p;
     d->req = evhttp_request_new(direct_request_done_cb, d);
+    p->cost.allocations++;
+    d->range.span_start = us_clock();
 
     copy_all_headers(p->server_req, d->req);
 
@@ -1938,6 +2452,12 @@ void direct_submit_request(proxy_request *p)
     bufferevent *server = p->server_req ? evhttp_connection_get_bufferevent(p->server_req->evcon) : NULL;
     bufferevent *bev = evhttp_connection_get_bufferevent(evcon);
     bufferevent_count_bytes(p->n, p->authority, p->localhost, server, bev);
+    if (bufferevent_getfd(bev) == -1) {
+        // not a pooled connection, so evhttp connects (and resolves) first
+        d->connect_start = us_clock();
+        d->connect_bev = bev;
+        d->connect_cb = evbuffer_add_cb(bufferevent_get_output(bev), direct_connect_cb, d);
+    }
     debug("p:%p d:%p evcon:%p direct request submitted: %s %s\n", p, d, evcon, evhttp_method(p->http_method), p->uri);
     evhttp_make_request(evcon, d->req, p->http_method, request_uri);
 }
@@ -1964,49 +2484,6 @@ void peer_submit_request_on_con(peer_request *r, evhttp_connection *evcon)
     evhttp_make_request(evcon, r->req, p->http_method, p->uri);
 }
 
-int peer_sort_cmp(const peer_sort *pa, const peer_sort *pb)
-{
-    return memcmp(pa, pb, sizeof(peer_sort));
-}
-
-#ifndef htonll
-#define htonll(x) ((((uint64_t)htonl(x)) << 32) + htonl((x) >> 32))
-#define ntohll htonll
-#endif
-
-peer* select_peer(peer_array *pa, peer_filter filter)
-{
-    peer_sort best = {.peer = NULL};
-    //debug("select_peer peers:%p length:%u\n", pa, pa->length);
-    for (uint i = 0; i < pa->length; i++) {
-        peer *p = pa->peers[i];
-        if (filter && filter(p)) {
-            continue;
-        }
-        peer_sort c;
-        c.failed = p->last_connect < p->last_connect_attempt;
-        int64_t time_since_verified = time(NULL) - p->last_verified;
-        c.time_since_verified = ntohll(time_since_verified);
-        int64_t last_connect_attempt = p->last_connect_attempt;
-        c.last_connect_attempt = ntohll(last_connect_attempt);
-        c.never_connected = !p->last_connect;
-        c.loop = p->loop;
-        c.salt = randombytes_uniform(0xFF);
-        c.peer = p;
-        if (0) {
-            debug("peer %s failed:%d time_since_verified:%"PRIu64" last_connect_attempt:%"PRIu64" never_connected:%d salt:%d p:%p\n",
-                  peer_addr_str(p),
-                  c.failed, htonll(c.time_since_verified), htonll(c.last_connect_attempt), c.never_connected, c.salt, c.peer);
-            debug("peer_sort_cmp:%d\n", peer_sort_cmp(&c, &best));
-        }
-        if (!i || peer_sort_cmp(&c, &best) < 0) {
-            //debug("better p:%p\n", p);
-            best = c;
-        }
-    }
-    return best.peer;
-}
-
 peer_connection* start_peer_connection(network *n, peer_array *peers, peer_filter filter)
 {
     peer *p = select_peer(peers, filter);
@@ -2036,8 +2513,8 @@ void queue_request(network *n, pending_request *r, peer_filter filter, peer_conn
     }
 
     static time_t last_lsd = 0;
-    if (!any_connected && time(NULL) - last_lsd > 10) {
-        last_lsd = time(NULL);
+    if (!any_connected && vtime_time() - last_lsd > 10) {
+        last_lsd = vtime_time();
         lsd_send(n, false);
     }
 
@@ -2053,7 +2530,7 @@ void queue_request(network *n, pending_request *r, peer_filter filter, peer_conn
         }
         peer_connections[i] = NULL;
         debug("using pc:%p evcon:%p via:%c for request:%p\n", pc, pc->evcon, pc->peer->via, r);
-        on_connect(pc);
+        on_connect(r, pc);
         return;
     }
 
@@ -2075,10 +2552,10 @@ void queue_request(network *n, pending_request *r, peer_filter filter, peer_conn
     }
 
     assert(!r->on_connect);
-    r->on_connect = Block_copy(on_connect);
+    r->on_connect = on_connect;
     TAILQ_INSERT_TAIL(&pending_requests, r, next);
     pending_requests_len++;
-    last_request = time(NULL);
+    last_request = vtime_time();
     debug("queued request:%p (outstanding:%zu)\n", r, pending_requests_len);
 }
 
@@ -2117,6 +2594,7 @@ peer_request* proxy_make_request(proxy_request *p)
 
     r->p = p;
     r->req = evhttp_request_new(peer_request_done_cb, r);
+    p->cost.allocations++;
 
     evkeyval *header;
     TAILQ_FOREACH(header, &p->output_headers, next) {
@@ -2154,6 +2632,17 @@ bool filter_peer(peer *peer, evhttp_request *server_req, const char *via)
     return sockaddr_eq((const sockaddr*)&ss, (const sockaddr*)&peer->addr) || via_contains(via, peer->via);
 }
 
+void proxy_peer_connected(pending_request *pr, peer_connection *pc)
+{
+    peer_request *r = container_of(pr, peer_request, r);
+    proxy_request *p = r->p;
+    debug("%s:%d peer:%p\n", __func__, __LINE__, pc->peer);
+    proxy_span(p, peer_slot(r), peer_is_injector(pc->peer) ? "connect injector" : "connect peer", r->range.span_start);
+    r->range.span_start = us_clock();
+    r->pc = pc;
+    peer_submit_request_on_con(r, r->pc->evcon);
+}
+
 void proxy_submit_request(proxy_request *p)
 {
     // TODO: kick off a separate HEAD request for hashes which blocks until hashes are available.
@@ -2165,14 +2654,12 @@ void proxy_submit_request(proxy_request *p)
 
     const char *via = evhttp_find_header(r->req->input_headers, "Via");
     r->r.via = via?strdup(via):NULL;
+    p->cost.allocations += !!r->r.via;
 
+    r->range.span_start = us_clock();
     queue_request(p->n, &r->r, ^bool(peer *peer) {
         return filter_peer(peer, p->server_req, via);
-    }, ^(peer_connection *pc) {
-        debug("%s:%d peer:%p\n", __func__, __LINE__, pc->peer);
-        r->pc = pc;
-        peer_submit_request_on_con(r, r->pc->evcon);
-    });
+    }, proxy_peer_connected);
 }
 
 void server_evcon_close_cb(evhttp_connection *evcon, void *ctx)
@@ -2202,7 +2689,11 @@ void submit_request(network *n, evhttp_request *server_req)
         }
     }
 
-    proxy_request *p = alloc(proxy_request);
+    startup_reached(STARTUP_FIRST_REQUEST);
+    // the request and its strings usually fit the first chunk
+    arena *a = arena_new(sizeof(proxy_request) + 1024);
+    proxy_request *p = arena_alloc(a, sizeof(proxy_request));
+    p->arena = a;
     p->n = n;
     p->start_time = us_clock();
     TAILQ_INIT(&p->direct_headers);
@@ -2210,14 +2701,34 @@ void submit_request(network *n, evhttp_request *server_req)
     p->cache_file = -1;
     p->range_start = range_start;
     p->range_end = range_end;
+    p->browser_range = range;
+    p->browser_range_end = range_end;
     p->server_req = server_req;
     const evhttp_uri *uri = evhttp_request_get_evhttp_uri(p->server_req);
     const char *host = evhttp_uri_get_host(uri);
-    p->authority = strdup(host ?: "");
+    p->authority = arena_strdup(p->arena, host ?: "");
     p->localhost = evcon_is_localhost(p->server_req->evcon);
     p->http_method = p->server_req->type;
-    p->uri = strdup(evhttp_request_get_uri(p->server_req));
+    p->uri = arena_strdup(p->arena, evhttp_request_get_uri(p->server_req));
     p->m = alloc(merkle_tree);
+    // m. the arena's are counted at cleanup
+    p->cost.allocations++;
+    TAILQ_INSERT_TAIL(&live_proxy_requests, p, next);
+
+    if (timeline_enabled()) {
+        p->timeline_id = timeline_new_id();
+        char name[2048];
+        snprintf(name, sizeof(name), "%s %s", evhttp_method(p->http_method), p->uri);
+        timeline_name(p->timeline_id, 0, name);
+        for (size_t i = 0; i < lenof(p->direct_requests); i++) {
+            snprintf(name, sizeof(name), "direct %zu", i);
+            timeline_name(p->timeline_id, 1 + i, name);
+        }
+        for (size_t i = 0; i < lenof(p->requests); i++) {
+            snprintf(name, sizeof(name), "peer %zu", i);
+            timeline_name(p->timeline_id, 1 + lenof(p->direct_requests) + i, name);
+        }
+    }
 
     debug("p:%p new request %s\n", p, p->uri);
 
@@ -2297,6 +2808,7 @@ void trace_request_done_cb(evhttp_request *req, void *arg)
     }
     evbuffer *input = req->input_buffer;
     if (req->response_code != 0) {
+        peer_load_reported(t->pc->peer, req);
         const char *msign = evhttp_find_header(req->input_headers, "X-MSign");
         if (!msign) {
             fprintf(stderr, "no signature on TRACE!\n");
@@ -2313,12 +2825,14 @@ void trace_request_done_cb(evhttp_request *req, void *arg)
             debug("verifying sig for TRACE %s %s\n", evhttp_request_get_uri(req), msign);
             if (verify_signature(root_hash, msign)) {
                 debug("signature good! %s\n", peer_addr_str(t->pc->peer));
-                t->pc->peer->last_connect = time(NULL);
+                t->pc->peer->last_connect = vtime_time();
+                peer_updated(t->pc->peer);
                 peer_verified(t->n, t->pc->peer);
                 peer_reuse(t->n, t->pc);
                 t->pc = NULL;
             } else {
                 t->pc->peer->last_verified = 0;
+                peer_updated(t->pc->peer);
             }
         }
     }
@@ -2374,16 +2888,20 @@ void trace_submit_request_on_con(trace_request *t, evhttp_connection *evcon)
     evhttp_make_request(evcon, req, EVHTTP_REQ_TRACE, request_uri);
 }
 
+void trace_peer_connected(pending_request *r, peer_connection *pc)
+{
+    trace_request *t = container_of(r, trace_request, r);
+    debug("%s:%d peer:%p\n", __func__, __LINE__, pc->peer);
+    t->pc = pc;
+    trace_submit_request_on_con(t, t->pc->evcon);
+}
+
 void submit_trace_request(network *n)
 {
     trace_request *t = alloc(trace_request);
     t->n = n;
     connect_more_injectors(n, true);
-    queue_request(n, &t->r, NULL, ^(peer_connection *pc) {
-        debug("%s:%d peer:%p\n", __func__, __LINE__, pc->peer);
-        t->pc = pc;
-        trace_submit_request_on_con(t, t->pc->evcon);
-    });
+    queue_request(n, &t->r, NULL, trace_peer_connected);
 }
 
 #define SOCKS5_REPLY_GRANTED 0x00 // request granted
@@ -2396,7 +2914,7 @@ void submit_trace_request(network *n)
 #define SOCKS5_REPLY_INVAL 0x07 // command not supported / protocol error
 #define SOCKS5_REPLY_AFNOSUPPORT 0x08 // address type not supported
 
-typedef struct {
+typedef struct connect_req {
     // HTTP CONNECT request
     evhttp_request *server_req;
     // SOCKS5 request
@@ -2410,6 +2928,8 @@ typedef struct {
     bufferevent *direct;
 
     network *n;
+    // c itself and authority
+    arena *arena;
 
     evbuffer *intro_data;
     bufferevent *pending_bev;
@@ -2417,10 +2937,15 @@ typedef struct {
 
     char *authority;
     int attempts;
+    uint64_t start_time;
+
+    TAILQ_ENTRY(connect_req) next;
 
     bool dont_free:1;
 } connect_req;
 
+TAILQ_HEAD(, connect_req) live_connect_requests = TAILQ_HEAD_INITIALIZER(live_connect_requests);
+
 void free_write_cb(bufferevent *bev, void *ctx)
 {
     debug("%s bev:%p\n", __func__, bev);
@@ -2494,8 +3019,8 @@ void connect_cleanup(connect_req *c)
         peer_disconnect(c->pc);
         c->pc = NULL;
     }
-    free(c->authority);
-    free(c);
+    TAILQ_REMOVE(&live_connect_requests, c, next);
+    arena_free(c->arena);
 }
 
 void connect_proxy_cancel(connect_req *c)
@@ -2558,7 +3083,8 @@ void connect_other_read_cb(bufferevent *bev, void *ctx)
         c->bevs[i] = NULL;
     }
 
-    // connected!
+    // connected! these are the first bytes of the tunnel on their way to the browser
+    startup_reached(STARTUP_FIRST_RESPONSE);
     bufferevent *server = c->pending_bev;
     debug("c:%p %s connection complete server:%p bev:%p intro_data_length:%zu\n", c, __func__, server, bev, evbuffer_get_length(c->intro_data));
     c->pending_bev = NULL;
@@ -2668,7 +3194,12 @@ void connect_done_cb(evhttp_request *req, void *arg)
     c->proxy_req = NULL;
     if (!c->direct && (c->server_req || c->server_bev)) {
         if (c->pc) {
-            peer_reuse(c->n, c->pc);
+            // don't hand a busy injector's connection straight back to the retry
+            if (peer_is_busy(c->pc->peer)) {
+                peer_disconnect(c->pc);
+            } else {
+                peer_reuse(c->n, c->pc);
+            }
             c->pc = NULL;
         }
         connect_invalid_reply(c);
@@ -2688,6 +3219,7 @@ int connect_header_cb(evhttp_request *req, void *arg)
 {
     connect_req *c = (connect_req *)arg;
     debug("c:%p connect_header_cb req:%p %d %s\n", c, req, req->response_code, req->response_code_line);
+    peer_load_reported(c->pc->peer, req);
     if (req->response_code != 200) {
         debug("%s req->response_code:%d\n", __func__, req->response_code);
 
@@ -2695,6 +3227,11 @@ int connect_header_cb(evhttp_request *req, void *arg)
             peer_is_loop(c->pc->peer);
         }
 
+        if (injector_is_busy(c->pc->peer, req)) {
+            // connect_done_cb retries with another peer
+            return 0;
+        }
+
         const char *msign = evhttp_find_header(req->input_headers, "X-MSign");
         if (msign) {
             debug("c:%p verifying sig for %s %s\n", c, evhttp_request_get_uri(req), msign);
@@ -2738,11 +3275,13 @@ int connect_header_cb(evhttp_request *req, void *arg)
             }
             fprintf(stderr, "signature failed!\n");
             c->pc->peer->last_verified = 0;
+            peer_updated(c->pc->peer);
         }
         return 0;
     }
 
-    c->pc->peer->last_connect = time(NULL);
+    c->pc->peer->last_connect = vtime_time();
+    peer_updated(c->pc->peer);
     free(c->pc);
     c->pc = NULL;
 
@@ -2804,6 +3343,7 @@ void connect_direct_event_cb(bufferevent *bev, short events, void *ctx)
         connect_send_error(c, code, reason);
         connect_cleanup(c);
     } else if (events & BEV_EVENT_CONNECTED) {
+        histogram_record(&g_connect_latency[SOURCE_DIRECT], us_clock() - c->start_time);
         c->direct = NULL;
         connected(c, bev);
     }
@@ -2822,6 +3362,25 @@ void connect_evcon_close_cb(evhttp_connection *evcon, void *ctx)
     connect_cleanup(c);
 }
 
+void connect_peer_connected(pending_request *r, peer_connection *pc)
+{
+    connect_req *c = container_of(r, connect_req, r);
+    debug("c:%p %s on_connect\n", c, __func__);
+    assert(!c->pc);
+    assert(!c->r.on_connect);
+
+    c->pc = pc;
+    assert(!c->proxy_req);
+    c->proxy_req = evhttp_request_new(connect_done_cb, c);
+    debug("c:%p %s made req:%p\n", c, __func__, c->proxy_req);
+
+    append_via(c->server_req, c->proxy_req->output_headers);
+
+    evhttp_request_set_header_cb(c->proxy_req, connect_header_cb);
+    evhttp_request_set_error_cb(c->proxy_req, connect_error_cb);
+    evhttp_make_request(c->pc->evcon, c->proxy_req, EVHTTP_REQ_CONNECT, c->authority);
+}
+
 void connect_peer(connect_req *c, bool injector_preference)
 {
     connect_more_injectors(c->n, injector_preference);
@@ -2833,22 +3392,18 @@ void connect_peer(connect_req *c, bool injector_preference)
     c->r.via = via?strdup(via):NULL;
     queue_request(c->n, &c->r, ^bool(peer *peer) {
         return filter_peer(peer, c->server_req, via);
-    }, ^(peer_connection *pc) {
-        debug("c:%p %s on_connect\n", c, __func__);
-        assert(!c->pc);
-        assert(!c->r.on_connect);
-
-        c->pc = pc;
-        assert(!c->proxy_req);
-        c->proxy_req = evhttp_request_new(connect_done_cb, c);
-        debug("c:%p %s made req:%p\n", c, __func__, c->proxy_req);
-
-        append_via(c->server_req, c->proxy_req->output_headers);
+    }, connect_peer_connected);
+}
 
-        evhttp_request_set_header_cb(c->proxy_req, connect_header_cb);
-        evhttp_request_set_error_cb(c->proxy_req, connect_error_cb);
-        evhttp_make_request(c->pc->evcon, c->proxy_req, EVHTTP_REQ_CONNECT, c->authority);
-    });
+connect_req* connect_req_new(network *n)
+{
+    startup_reached(STARTUP_FIRST_REQUEST);
+    arena *a = arena_new(sizeof(connect_req) + 256);
+    connect_req *c = arena_alloc(a, sizeof(connect_req));
+    c->arena = a;
+    c->n = n;
+    c->start_time = us_clock();
+    return c;
 }
 
 void connect_request(network *n, evhttp_request *req)
@@ -2871,10 +3426,10 @@ void connect_request(network *n, evhttp_request *req)
         return;
     }
 
-    connect_req *c = alloc(connect_req);
-    c->n = n;
+    connect_req *c = connect_req_new(n);
     c->server_req = req;
-    c->authority = strdup(evhttp_request_get_uri(c->server_req));
+    c->authority = arena_strdup(c->arena, evhttp_request_get_uri(c->server_req));
+    TAILQ_INSERT_TAIL(&live_connect_requests, c, next);
 
     evhttp_connection_set_closecb(c->server_req->evcon, connect_evcon_close_cb, c);
 
@@ -2896,6 +3451,167 @@ void connect_request(network *n, evhttp_request *req)
 int evhttp_parse_firstline_(evhttp_request *, evbuffer*);
 int evhttp_parse_headers_(evhttp_request *, evbuffer*);
 
+void client_metrics(network *n, evbuffer *out)
+{
+    uint connected = 0;
+    uint connecting = 0;
+    for (uint i = 0; i < lenof(peer_connections); i++) {
+        if (!peer_connections[i]) {
+            continue;
+        }
+        if (peer_connections[i]->evcon) {
+            connected++;
+        } else {
+            connecting++;
+        }
+    }
+    metrics_header(out, "newnode_peer_connections", "gauge", "pooled peer connections (of 20)");
+    metrics_value(out, "newnode_peer_connections", "state=\"connected\"", connected);
+    metrics_value(out, "newnode_peer_connections", "state=\"connecting\"", connecting);
+    metrics_gauge(out, "newnode_pending_requests", "requests waiting for a peer connection", pending_requests_len);
+
+    metrics_header(out, "newnode_peers", "gauge", "known peers");
+    metrics_value(out, "newnode_peers", "set=\"injectors\"", injectors->length);
+    metrics_value(out, "newnode_peers", "set=\"injector_proxies\"", injector_proxies->length);
+    metrics_value(out, "newnode_peers", "set=\"all_peers\"", all_peers->length);
+    metrics_gauge(out, "newnode_injector_reachable", "an injector verified recently", !!injector_reachable);
+    metrics_header(out, "newnode_startup_us", "gauge", "time from launch to each startup milestone reached");
+    for (size_t i = 0; i < lenof(startup_names); i++) {
+        if (!g_startup[i]) {
+            continue;
+        }
+        char labels[64];
+        snprintf(labels, sizeof(labels), "phase=\"%s\"", startup_names[i]);
+        metrics_value(out, "newnode_startup_us", labels, g_startup[i]);
+    }
+    metrics_header(out, "newnode_swarm_peers_found_total", "counter", "peers returned by DHT searches");
+    for (size_t i = 0; i < lenof(swarm_names); i++) {
+        char labels[64];
+        snprintf(labels, sizeof(labels), "swarm=\"%s\"", swarm_names[i]);
+        metrics_value(out, "newnode_swarm_peers_found_total", labels, g_swarm_peers_found[i]);
+    }
+
+    __block byte_counts total = {0};
+    if (byte_count_per_authority) {
+        hash_iter(byte_count_per_authority, ^bool (const char *authority, void *val) {
+            authority_byte_counts *b = val;
+            total.from_browser += b->total.from_browser;
+            total.to_browser += b->total.to_browser;
+            total.from_peer += b->total.from_peer;
+            total.to_peer += b->total.to_peer;
+            total.from_direct += b->total.from_direct;
+            total.to_direct += b->total.to_direct;
+            total.from_p2p += b->total.from_p2p;
+            total.to_p2p += b->total.to_p2p;
+            return true;
+        });
+    }
+    metrics_header(out, "newnode_bytes_total", "counter", "proxied bytes by source");
+    metrics_value(out, "newnode_bytes_total", "source=\"browser\",direction=\"in\"", total.from_browser);
+    metrics_value(out, "newnode_bytes_total", "source=\"browser\",direction=\"out\"", total.to_browser);
+    metrics_value(out, "newnode_bytes_total", "source=\"peer\",direction=\"in\"", total.from_peer);
+    metrics_value(out, "newnode_bytes_total", "source=\"peer\",direction=\"out\"", total.to_peer);
+    metrics_value(out, "newnode_bytes_total", "source=\"direct\",direction=\"in\"", total.from_direct);
+    metrics_value(out, "newnode_bytes_total", "source=\"direct\",direction=\"out\"", total.to_direct);
+    metrics_value(out, "newnode_bytes_total", "source=\"p2p\",direction=\"in\"", total.from_p2p);
+    metrics_value(out, "newnode_bytes_total", "source=\"p2p\",direction=\"out\"", total.to_p2p);
+
+    metrics_header(out, "newnode_cache_requests_total", "counter", "proxy requests by cache result");
+    metrics_value(out, "newnode_cache_requests_total", "result=\"hit\"", g_cache_hits);
+    metrics_value(out, "newnode_cache_requests_total", "result=\"not_modified\"", g_cache_not_modified);
+    metrics_value(out, "newnode_cache_requests_total", "result=\"miss\"", g_cache_misses);
+
+    metrics_counter(out, "newnode_signatures_verified_total", "Ed25519 signature checks", g_signatures_verified);
+    metrics_counter(out, "newnode_signature_cache_hits_total", "signature checks answered by the cache", g_signature_cache_hits);
+
+    struct {
+        const char *name;
+        const char *help;
+        histogram *h;
+        size_t sources;
+    } phases[] = {
+        {"newnode_connect_latency_us", "connection setup time (direct includes DNS)", g_connect_latency, lenof(g_connect_latency)},
+        {"newnode_first_byte_latency_us", "time from request to response headers", g_first_byte_latency, lenof(g_first_byte_latency)},
+        {"newnode_verify_latency_us", "response header signature verification time", g_verify_latency, lenof(g_verify_latency)},
+        {"newnode_complete_latency_us", "time from request to last byte sent to the browser", g_complete_latency, lenof(g_complete_latency)},
+    };
+    for (size_t i = 0; i < lenof(phases); i++) {
+        metrics_header(out, phases[i].name, "summary", phases[i].help);
+        for (size_t j = 0; j < phases[i].sources; j++) {
+            if (!phases[i].h[j].count) {
+                continue;
+            }
+            char labels[64];
+            snprintf(labels, sizeof(labels), "source=\"%s\"", source_names[j]);
+            histogram_metrics(out, phases[i].name, labels, &phases[i].h[j]);
+        }
+    }
+
+    network_metrics(n, out);
+}
+
+void debug_range(evbuffer *out, const proxy_request *p, const chunked_range *r)
+{
+    evbuffer_add_printf(out, " range:%"PRIu64"-%"PRIu64" chunk:%"PRIu64"/%"PRIu64" buffered:%zu bytes:%"PRIu64"\n",
+                        r->start, r->end, r->chunk_index, num_chunks(p),
+                        r->chunk_buffer ? evbuffer_get_length(r->chunk_buffer) : 0, r->bytes);
+}
+
+void debug_requests(evbuffer *out)
+{
+    uint64_t now = us_clock();
+    proxy_request *p;
+    TAILQ_FOREACH(p, &live_proxy_requests, next) {
+        uint64_t have = 0;
+        uint64_t chunks = p->have_bitfield ? num_chunks(p) : 0;
+        for (uint64_t i = 0; i < chunks; i++) {
+            have += p->have_bitfield[i];
+        }
+        evbuffer_add_printf(out, "p:%p %s %s age:%.2fms\n", p, evhttp_method(p->http_method), p->uri,
+                            (double)(now - p->start_time) / 1000.0);
+        evbuffer_add_printf(out, "  server_req:%p code:%d merkle_tree_finished:%d chunks:%"PRIu64"/%"PRIu64
+                            " byte_playhead:%"PRIu64"/%"PRIu64" bytes_direct:%"PRIu64" bytes_peer:%"PRIu64
+                            " bytes_injector:%"PRIu64"\n",
+                            p->server_req, p->direct_code, p->merkle_tree_finished, have, chunks,
+                            p->byte_playhead, p->total_length, p->bytes_direct, p->bytes_peer, p->bytes_injector);
+        for (size_t i = 0; i < lenof(p->direct_requests); i++) {
+            const direct_request *d = &p->direct_requests[i];
+            if (!d->req && !d->evcon) {
+                continue;
+            }
+            evbuffer_add_printf(out, "  direct[%zu] d:%p req:%p evcon:%p", i, d, d->req, d->evcon);
+            debug_range(out, p, &d->range);
+        }
+        for (size_t i = 0; i < lenof(p->requests); i++) {
+            const peer_request *r = &p->requests[i];
+            if (r->r.on_connect) {
+                evbuffer_add_printf(out, "  peer[%zu] r:%p waiting for connection\n", i, r);
+                continue;
+            }
+            if (!r->req) {
+                continue;
+            }
+            evbuffer_add_printf(out, "  peer[%zu] r:%p req:%p peer:%s", i, r, r->req,
+                                r->pc && r->pc->peer ? peer_addr_str(r->pc->peer) : "-");
+            debug_range(out, p, &r->range);
+        }
+    }
+    connect_req *c;
+    TAILQ_FOREACH(c, &live_connect_requests, next) {
+        evbuffer_add_printf(out, "c:%p CONNECT %s age:%.2fms attempts:%d\n", c, c->authority,
+                            (double)(now - c->start_time) / 1000.0, c->attempts);
+        uint bevs = 0;
+        for (size_t i = 0; i < lenof(c->bevs); i++) {
+            bevs += !!c->bevs[i];
+        }
+        evbuffer_add_printf(out, "  %s:%p direct:%p proxy_req:%p peer:%s waiting:%d pending_bev:%p bevs:%u\n",
+                            c->server_req ? "server_req" : "server_bev",
+                            c->server_req ? (void*)c->server_req : (void*)c->server_bev,
+                            c->direct, c->proxy_req, c->pc && c->pc->peer ? peer_addr_str(c->pc->peer) : "-",
+                            !!c->r.on_connect, c->pending_bev, bevs);
+    }
+}
+
 void http_request_cb(evhttp_request *req, void *arg)
 {
     network *n = (network*)arg;
@@ -2935,6 +3651,9 @@ void http_request_cb(evhttp_request *req, void *arg)
     }
 
     if (req->type == EVHTTP_REQ_CONNECT) {
+        // tunneled bytes aren't counted, only that the tunnel was asked for
+        uint64_t now = us_clock();
+        trace_record(now, now, "CONNECT", 0, 0, "tunnel", false, 0, 0, evhttp_request_get_uri(req));
         connect_request(n, req);
         return;
     }
@@ -2953,6 +3672,33 @@ void http_request_cb(evhttp_request *req, void *arg)
         evbuffer_free(body);
         return;
     }
+    if (req->type == EVHTTP_REQ_GET && !host &&
+        evcon_is_localhost(req->evcon) && streq(evhttp_request_get_uri(req), "/metrics")) {
+        evhttp_add_header(req->output_headers, "Content-Type", "text/plain; version=0.0.4");
+        evbuffer *body = evbuffer_new();
+        client_metrics(n, body);
+        evhttp_send_reply(req, 200, "OK", body);
+        evbuffer_free(body);
+        return;
+    }
+    if (req->type == EVHTTP_REQ_GET && !host &&
+        evcon_is_localhost(req->evcon) && streq(evhttp_request_get_uri(req), "/debug/requests")) {
+        evhttp_add_header(req->output_headers, "Content-Type", "text/plain");
+        evbuffer *body = evbuffer_new();
+        debug_requests(body);
+        evhttp_send_reply(req, 200, "OK", body);
+        evbuffer_free(body);
+        return;
+    }
+    if (req->type == EVHTTP_REQ_GET && !host &&
+        evcon_is_localhost(req->evcon) && streq(evhttp_request_get_uri(req), "/debug/cost")) {
+        evhttp_add_header(req->output_headers, "Content-Type", "text/plain");
+        evbuffer *body = evbuffer_new();
+        cost_report(cost_per_authority, body);
+        evhttp_send_reply(req, 200, "OK", body);
+        evbuffer_free(body);
+        return;
+    }
     if (req->type != EVHTTP_REQ_TRACE &&
         (!host || !scheme ||
          (evutil_ascii_strcasecmp(scheme, "http") && evutil_ascii_strcasecmp(scheme, "https")))) {
@@ -2968,10 +3714,13 @@ void http_request_cb(evhttp_request *req, void *arg)
     snprintf(cache_path, sizeof(cache_path), "%s%s", CACHE_PATH, encoded_uri);
     snprintf(cache_headers_path, sizeof(cache_headers_path), "%s.headers", cache_path);
     free(encoded_uri);
+    uint64_t cache_start = us_clock();
     int cache_file = open(cache_path, O_RDONLY);
     int headers_file = open(cache_headers_path, O_RDONLY);
     debug("check hit:%d,%d cache:%s\n", cache_file != -1, headers_file != -1, cache_path);
     if (!NO_CACHE && cache_file != -1 && headers_file != -1) {
+        g_cache_hits++;
+        PROBE1(cache_hit, uri);
         evhttp_request *temp = evhttp_request_new(NULL, NULL);
         evbuffer *header_buf = evbuffer_new();
         ev_off_t length = lseek(headers_file, 0, SEEK_END);
@@ -3012,6 +3761,8 @@ void http_request_cb(evhttp_request *req, void *arg)
             uint8_t *content_hash = base64_decode(ifnonematch, strlen(ifnonematch), &out_len);
             if (out_len == crypto_generichash_BYTES &&
                 verify_signature(content_hash, msign)) {
+                g_cache_not_modified++;
+                PROBE1(cache_not_modified, uri);
                 temp->response_code = 304;
                 free(temp->response_code_line);
                 temp->response_code_line = strdup("Not Modified");
@@ -3032,16 +3783,22 @@ void http_request_cb(evhttp_request *req, void *arg)
         }
         debug("req:%p evcon:%p responding with cache %d %s start:%"PRIu64" end:%"PRIu64" length:%"PRIu64"\n", req, req->evcon,
             temp->response_code, temp->response_code_line, range_start, range_end, (range_end - range_start) + 1);
+        trace_record(cache_start, us_clock(), evhttp_method(req->type), temp->response_code,
+                     content ? (range_end - range_start) + 1 : 0, source_names[SOURCE_CACHE],
+                     range, range_start, range_end, uri);
         evhttp_send_reply(req, temp->response_code, temp->response_code_line, content);
         evhttp_request_free(temp);
         if (content) {
             evbuffer_free(content);
         }
+        histogram_record(&g_complete_latency[SOURCE_CACHE], us_clock() - cache_start);
         return;
     }
     close(cache_file);
     close(headers_file);
 
+    g_cache_misses++;
+    PROBE1(cache_miss, uri);
     submit_request(n, req);
 }
 
@@ -3050,34 +3807,36 @@ void save_peer_file(const char *s, peer_array *pa)
     FILE *f = fopen(s, "wb");
     if (f) {
         for (size_t i = 0; i < pa->length; i++) {
-            if (time(NULL) - pa->peers[i]->last_verified < 7 * 24 * 60 * 60) {
-                fwrite(pa->peers[i], sizeof(peer), 1, f);
+            if (vtime_time() - pa->peers[i]->last_verified < 7 * 24 * 60 * 60) {
+                fwrite(pa->peers[i], PEER_FILE_SIZE, 1, f);
             }
         }
         fclose(f);
     }
 }
 
+void save_peers_cb(void *arg)
+{
+    save_peer_file("injectors.dat", injectors);
+    save_peer_file("injector_proxies.dat", injector_proxies);
+    save_peer_file("peers.dat", all_peers);
+}
+
 void save_peers(network *n)
 {
-    if (saving_peers) {
-        return;
+    if (!timer_scheduled(&saving_peers)) {
+        timer_schedule(&saving_peers, 1000);
     }
-    saving_peers = timer_start(n, 1000, ^{
-        saving_peers = NULL;
-        save_peer_file("injectors.dat", injectors);
-        save_peer_file("injector_proxies.dat", injector_proxies);
-        save_peer_file("peers.dat", all_peers);
-    });
 }
 
-void load_peer_file(const char *s, peer_array **pa)
+void load_peer_file(network *n, const char *s, peer_array **pa)
 {
     FILE *f = fopen(s, "rb");
     if (f) {
-        peer p;
-        while (fread(&p, sizeof(p), 1, f) == 1) {
-            add_peer(pa, memdup(&p, sizeof(p)));
+        peer p = {0};
+        while (fread(&p, PEER_FILE_SIZE, 1, f) == 1) {
+            p.load = 0;
+            add_peer(n, pa, memdup(&p, sizeof(p)));
         }
         const char *label = "peers";
         if (*pa == injectors) {
@@ -3092,9 +3851,9 @@ void load_peer_file(const char *s, peer_array **pa)
 
 void load_peers(network *n)
 {
-    load_peer_file("injectors.dat", &injectors);
-    load_peer_file("injector_proxies.dat", &injector_proxies);
-    load_peer_file("peers.dat", &all_peers);
+    load_peer_file(n, "injectors.dat", &injectors);
+    load_peer_file(n, "injector_proxies.dat", &injector_proxies);
+    load_peer_file(n, "peers.dat", &all_peers);
 }
 
 void socks_connect_event_cb(bufferevent *bev, short events, void *ctx)
@@ -3123,6 +3882,7 @@ void socks_connect_event_cb(bufferevent *bev, short events, void *ctx)
         }
         connect_cleanup(c);
     } else if (events & BEV_EVENT_CONNECTED) {
+        histogram_record(&g_connect_latency[SOURCE_DIRECT], us_clock() - c->start_time);
         c->direct = NULL;
         connected(c, bev);
     }
@@ -3143,12 +3903,12 @@ void socks_event_cb(bufferevent *bev, short events, void *ctx)
 
 bufferevent* socks_connect_request(network *n, bufferevent *bev, const char *host, port_t port)
 {
-    connect_req *c = alloc(connect_req);
-    c->n = n;
+    connect_req *c = connect_req_new(n);
     c->server_bev = bev;
     char authority[1024];
     snprintf(authority, sizeof(authority), "%s:%u", host, port);
-    c->authority = strdup(authority);
+    c->authority = arena_strdup(c->arena, authority);
+    TAILQ_INSERT_TAIL(&live_connect_requests, c, next);
 
     debug("c:%p %s bev:%p SOCKS5 CONNECT %s:%u\n", c, __func__, bev, host, port);
 
@@ -3311,6 +4071,7 @@ network* client_init(const char *app_name, const char *app_id, port_t *http_port
 {
     //o_debug = 1;
 
+    g_startup_time = us_clock();
     g_app_name = strdup(app_name);
     g_app_id = strdup(app_id);
     g_https_cb = Block_copy(https_cb);
@@ -3331,6 +4092,9 @@ network* client_init(const char *app_name, const char *app_id, port_t *http_port
         fclose(f);
     }
     network *n = network_setup("::", port_pref);
+    startup_reached(STARTUP_NETWORK);
+    timer_init(&verify_batch_timer, n, verify_batch_cb, n);
+    timer_init(&saving_peers, n, save_peers_cb, NULL);
 
     port_pref = n->port;
     f = fopen("port.dat", "wb");
@@ -3396,9 +4160,11 @@ network* client_init(const char *app_name, const char *app_id, port_t *http_port
     g_http_port = *http_port;
     g_socks_port = *socks_port;
     printf("listening on TCP: %s:%d,%d\n", "127.0.0.1", *http_port, *socks_port);
+    startup_reached(STARTUP_LISTENING);
 
     timer_start(n, 0, ^{
         load_peers(n);
+        startup_reached(STARTUP_PEERS_LOADED);
 
         // for local debugging
         /*
@@ -3417,7 +4183,7 @@ network* client_init(const char *app_name, const char *app_id, port_t *http_port
         add_sockaddr(n, (sockaddr *)&iin, sizeof(iin));
 
         timer_callback cb = ^{
-            time_t t = time(NULL);
+            time_t t = vtime_time();
             tm *tm = gmtime(&t);
             char name[1024];
 
@@ -3435,7 +4201,11 @@ network* client_init(const char *app_name, const char *app_id, port_t *http_port
             update_injector_proxy_swarm(n);
         };
         cb();
-        timer_repeating(n, 25 * 60 * 1000, cb);
+        timer_repeating(n, o_swarm_interval * 1000, cb);
+
+        timer_repeating(n, LOAD_HALF_LIFE * 1000, ^{
+            decay_injector_load();
+        });
     });
 
     return n;
@@ -3446,6 +4216,17 @@ network* newnode_init(const char *app_name, const char *app_id, port_t *http_por
     return client_init(app_name, app_id, http_port, socks_port, https_cb);
 }
 
+bool newnode_add_injector(network *n, const char *address)
+{
+    sockaddr_storage ss;
+    int sslen = sizeof(ss);
+    if (evutil_parse_sockaddr_port(address, (sockaddr *)&ss, &sslen)) {
+        return false;
+    }
+    add_address(n, &injectors, (sockaddr *)&ss, sslen);
+    return true;
+}
+
 int newnode_run(network *n)
 {
     return network_loop(n);
@@ -4,6 +4,9 @@
 #include "network.h"
 #include "thread.h"
 #include "log.h"
+#include "timeline.h"
+#include "trace.h"
+#include "vtime.h"
 
 #ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
@@ -13,16 +16,42 @@
 int main(int argc, char *argv[])
 {
     char *port_s = "8006";
+    char *injectors[16];
+    uint injectors_len = 0;
 
     for (;;) {
-        int c = getopt(argc, argv, "p:v");
+        int c = getopt(argc, argv, "b:i:p:r:S:t:T:v");
         if (c == -1) {
             break;
         }
         switch (c) {
+        case 'b':
+            o_dht_bootstrap = optarg;
+            break;
+        case 'i':
+            if (injectors_len < lenof(injectors)) {
+                injectors[injectors_len++] = optarg;
+            }
+            break;
         case 'p':
             port_s = optarg;
             break;
+        case 'r':
+            o_swarm_interval = MAX(atoi(optarg), 1);
+            break;
+        case 'S':
+            vtime_setup(optarg);
+            break;
+        case 't':
+            if (!timeline_open(optarg)) {
+                pdie("timeline_open");
+            }
+            break;
+        case 'T':
+            if (!trace_open(optarg)) {
+                pdie("trace_open");
+            }
+            break;
         case 'v':
             o_debug++;
             break;
@@ -40,6 +69,11 @@ int main(int argc, char *argv[])
     if (!n) {
         return 1;
     }
+    for (uint i = 0; i < injectors_len; i++) {
+        if (!newnode_add_injector(n, injectors[i])) {
+            die("bad injector address: %s\n", injectors[i]);
+        }
+    }
 
 #ifdef __APPLE__
     newnode_thread(n);
@@ -0,0 +1,133 @@
+#!/bin/bash
+
+# Cold start benchmark: how soon a freshly launched client serves its first proxied request.
+# Build with `DEBUG=1 ./build.sh` so the injector signs with the built-in test key.
+#
+#   TARGET_MS=1000 ./coldstart.sh
+#
+# Three launches of a client, each requesting an uncached object right away:
+#   cold     no saved state, the injector given with -i
+#   warm     the first run's saved state (injectors.dat, peers, dht.dat), no -i
+#   blocked  like cold, but the origin is unroutable from the client, so direct fetches fail
+#            and the response has to come through the injector
+# Prints one JSON line per launch: time until the port opened and until the first response,
+# whether that met TARGET_MS, and the client's newnode_startup_us milestones.
+#
+# Runs in its own network namespace (unshare), like sim.sh. The origin listens on ORIGIN_ADDR
+# on lo. The blocked client gets a namespace of its own, linked to the injector by a veth pair
+# on CLIENT_NET, with no route to ORIGIN_ADDR.
+
+set -e
+
+ORIGIN_PORT=${ORIGIN_PORT:-8000}
+INJECTOR_PORT=${INJECTOR_PORT:-8005}
+CLIENT_PORT=${CLIENT_PORT:-8100}
+OBJECT_SIZE=${OBJECT_SIZE:-65536}
+TARGET_MS=${TARGET_MS:-1000}
+ORIGIN_ADDR=${ORIGIN_ADDR:-10.78.0.1}
+CLIENT_NET=${CLIENT_NET:-10.79.0}
+
+if [ -z "$COLDSTART_NETNS" ]; then
+    export COLDSTART_NETNS=1
+    if [ $(id -u) = 0 ]; then
+        exec unshare -n "$0" "$@"
+    fi
+    exec unshare -rn "$0" "$@"
+fi
+ip link set lo up
+ip addr add $ORIGIN_ADDR/32 dev lo
+
+BIN=$(cd $(dirname $0) && pwd)
+WORK=$(mktemp -d)
+
+function cleanup {
+    kill -SIGTERM $(jobs -pr) 2>/dev/null || true
+    rm -rf $WORK
+}
+trap cleanup EXIT
+trap 'exit 1' HUP INT TERM
+
+function now {
+    date +'%M:%S'
+}
+
+function ms {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# wait_port <port> [addr]
+function wait_port {
+    for i in $(seq 100); do
+        if (echo > /dev/tcp/${2:-127.0.0.1}/$1) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "$(now) port $1 did not open"
+    return 1
+}
+
+# launch <name> <dir> <client args...>. with NS set, the client and its requests run under it
+function launch {
+    local name=$1
+    local dir=$2
+    shift 2
+    local start=$(ms)
+    mkdir -p $dir
+    (cd $dir && exec $NS $BIN/client -p $CLIENT_PORT "$@" >> log 2>&1) &
+    local pid=$!
+    # poll rather than sleep, the port usually opens within milliseconds
+    while ! $NS bash -c "echo > /dev/tcp/127.0.0.1/$CLIENT_PORT" 2>/dev/null; do
+        if [ $(( $(ms) - start )) -gt 10000 ]; then
+            echo "$(now) client did not open its port"
+            return 1
+        fi
+    done
+    local listening=$(( $(ms) - start ))
+    local code=$($NS curl -s -o /dev/null -m 30 -w '%{http_code}' -x 127.0.0.1:$CLIENT_PORT \
+                 http://$ORIGIN_ADDR:$ORIGIN_PORT/obj/$OBJECT_SIZE?$name || true)
+    local first=$(( $(ms) - start ))
+    local met=false
+    if [ "$code" = 200 ] && [ $first -le $TARGET_MS ]; then
+        met=true
+    fi
+    # leave time for the injector to be verified and the peer files to be saved
+    sleep 2
+    local phases=$($NS curl -s http://127.0.0.1:$CLIENT_PORT/metrics | \
+        awk -F'[{}"= ]+' '/^newnode_startup_us\{/ { printf("%s\"%s_ms\":%.1f", n++ ? "," : "", $3, $4 / 1000) }')
+    kill -SIGTERM $pid
+    wait $pid || true
+    echo "{\"run\":\"$name\",\"code\":\"$code\",\"listening_ms\":$listening,\"first_response_ms\":$first,\"target_ms\":$TARGET_MS,\"met\":$met,\"phases\":{$phases}}"
+}
+
+#-------------------------------------------------------------------------------
+echo "$(now) Starting origin and injector."
+$BIN/loadgen -O $ORIGIN_ADDR:$ORIGIN_PORT > $WORK/origin.log 2>&1 &
+wait_port $ORIGIN_PORT $ORIGIN_ADDR
+mkdir -p $WORK/injector
+(cd $WORK/injector && exec $BIN/injector -p $INJECTOR_PORT > log 2>&1) &
+wait_port $INJECTOR_PORT
+
+#-------------------------------------------------------------------------------
+echo "$(now) Cold launch."
+launch cold $WORK/client -i 127.0.0.1:$INJECTOR_PORT
+echo "$(now) Warm launch."
+launch warm $WORK/client
+
+#-------------------------------------------------------------------------------
+echo "$(now) Blocked launch."
+unshare -n sleep 1000000 &
+holder=$!
+while [ "$(readlink /proc/$holder/ns/net)" = "$(readlink /proc/$$/ns/net)" ]; do
+    sleep 0.01
+done
+ns="nsenter -t $holder -n"
+ip link add cs0 type veth peer name cs1 netns $holder
+ip addr add $CLIENT_NET.1/24 dev cs0
+ip link set cs0 up
+$ns ip link set lo up
+$ns ip addr add $CLIENT_NET.2/24 dev cs1
+$ns ip link set cs1 up
+NS=$ns launch blocked $WORK/blocked -i $CLIENT_NET.1:$INJECTOR_PORT
+
+echo "$(now) DONE"
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <event2/buffer.h>
+
+#include "network.h"
+#include "hash_table.h"
+#include "cost.h"
+
+
+void cost_buffered(request_cost *c, uint64_t buffered)
+{
+    c->peak_buffered = MAX(c->peak_buffered, buffered);
+}
+
+void cost_format(const request_cost *c, char *buf, size_t len)
+{
+    snprintf(buf, len, "hashed:%"PRIu64" signatures:%"PRIu64" allocations:%"PRIu64
+             " disk_writes:%"PRIu64" disk_bytes:%"PRIu64" cache_syscalls:%"PRIu64" peak_buffered:%"PRIu64,
+             c->bytes_hashed, c->signatures, c->allocations,
+             c->disk_writes, c->disk_bytes, c->cache_syscalls, c->peak_buffered);
+}
+
+void cost_account(hash_table **by_authority, const char *authority, const request_cost *c)
+{
+    if (!*by_authority) {
+        *by_authority = hash_table_create();
+    }
+    authority_cost *a = hash_get(*by_authority, authority);
+    if (!a) {
+        a = alloc(authority_cost);
+        hash_set(*by_authority, strdup(authority), a);
+    }
+    a->requests++;
+    a->total.bytes_hashed += c->bytes_hashed;
+    a->total.signatures += c->signatures;
+    a->total.allocations += c->allocations;
+    a->total.disk_writes += c->disk_writes;
+    a->total.disk_bytes += c->disk_bytes;
+    a->total.cache_syscalls += c->cache_syscalls;
+    a->total.peak_buffered = MAX(a->total.peak_buffered, c->peak_buffered);
+}
+
+void cost_report(hash_table *by_authority, evbuffer *out)
+{
+    if (!by_authority) {
+        return;
+    }
+    hash_iter(by_authority, ^bool (const char *authority, void *val) {
+        authority_cost *a = val;
+        char buf[512];
+        cost_format(&a->total, buf, sizeof(buf));
+        evbuffer_add_printf(out, "%s requests:%"PRIu64" %s\n", authority, a->requests, buf);
+        return true;
+    });
+}
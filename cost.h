@@ -0,0 +1,35 @@
+#ifndef __COST_H__
+#define __COST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "network.h"
+#include "hash_table.h"
+
+
+// what a single request cost to serve. signatures are verified on the
+// client and created on the injector. allocations are the ones made for
+// the request by our own code, not by libevent.
+typedef struct {
+    uint64_t bytes_hashed;
+    uint64_t signatures;
+    uint64_t allocations;
+    uint64_t disk_writes;
+    uint64_t disk_bytes;
+    uint64_t cache_syscalls;
+    uint64_t peak_buffered;
+} request_cost;
+
+typedef struct {
+    uint64_t requests;
+    // peak_buffered is the largest of any request
+    request_cost total;
+} authority_cost;
+
+void cost_buffered(request_cost *c, uint64_t buffered);
+void cost_format(const request_cost *c, char *buf, size_t len);
+void cost_account(hash_table **by_authority, const char *authority, const request_cost *c);
+void cost_report(hash_table *by_authority, evbuffer *out);
+
+#endif // __COST_H__
@@ -14,7 +14,10 @@
 
 #include "dht.h"
 #include "log.h"
+#include "timer.h"
+#include "vtime.h"
 #include "network.h"
+#include "probes.h"
 
 
 struct dht {
@@ -23,8 +26,19 @@ struct dht {
     unsigned char save_hash[crypto_generichash_BYTES];
     const sockaddr *peer_sa;
     bool filter_running:1;
+    sockaddr_storage *pings;
+    uint pings_len;
+    uint pings_size;
+    timer ping_timer;
 };
 
+// saved nodes and peers are pinged a batch at a time, so a big dht.dat doesn't stall startup
+#define DHT_PING_BATCH 64
+#define DHT_PING_INTERVAL_MS 20
+
+const char *o_dht_bootstrap;
+uint o_swarm_interval = 25 * 60;
+
 uint8_t rand_hash[20];
 sockaddr_storage **blacklist;
 uint blacklist_len;
@@ -47,6 +61,11 @@ void dht_filter_event_callback(void *closure, int event, const unsigned char *in
         }
         return;
     }
+    if (event == DHT_EVENT_SEARCH_DONE || event == DHT_EVENT_SEARCH_DONE6) {
+        PROBE2(dht_search_done, info_hash, event);
+    } else {
+        PROBE3(dht_values, info_hash, event, data_len);
+    }
     dht_event_callback(closure, event, info_hash, data, data_len);
 }
 
@@ -70,6 +89,39 @@ void dht_add_bootstrap(dht *d, const char *host, port_t port)
     evdns_getaddrinfo(d->n->evdns, host, portbuf, &hint, dht_add_bootstrap_cb, d);
 }
 
+void dht_ping_batch(void *arg)
+{
+    dht *d = (dht*)arg;
+    uint batch = MIN(d->pings_len, DHT_PING_BATCH);
+    for (uint i = 0; i < batch; i++) {
+        const sockaddr *sa = (const sockaddr *)&d->pings[--d->pings_len];
+        dht_ping_node(sa, sockaddr_get_length(sa));
+    }
+    if (!d->pings_len) {
+        free(d->pings);
+        d->pings = NULL;
+        d->pings_size = 0;
+        return;
+    }
+    timer_schedule(&d->ping_timer, DHT_PING_INTERVAL_MS);
+}
+
+void dht_ping_later(dht *d, const sockaddr *sa, socklen_t salen)
+{
+    if (!d) {
+        return;
+    }
+    if (d->pings_len == d->pings_size) {
+        // dht.dat can hold thousands of nodes, so grow by doubling
+        d->pings_size = MAX(2 * d->pings_size, DHT_PING_BATCH);
+        d->pings = realloc(d->pings, d->pings_size * sizeof(sockaddr_storage));
+    }
+    memcpy(&d->pings[d->pings_len++], sa, MIN(salen, sizeof(sockaddr_storage)));
+    if (!timer_scheduled(&d->ping_timer)) {
+        timer_schedule(&d->ping_timer, 0);
+    }
+}
+
 dht* dht_setup(network *n)
 {
     if (o_debug >= 2) {
@@ -77,8 +129,11 @@ dht* dht_setup(network *n)
     }
     dht *d = alloc(dht);
     d->n = n;
+    timer_init(&d->ping_timer, n, dht_ping_batch, d);
     uint8_t myid[20];
     randombytes_buf(myid, sizeof(myid));
+    char hex[2 * sizeof(myid) + 1];
+    debug("dht id:%s\n", sodium_bin2hex(hex, sizeof(hex), myid, sizeof(myid)));
     dht_init(d->n->fd, d->n->fd, myid, NULL);
 
     FILE *f = fopen("dht.dat", "rb");
@@ -91,7 +146,7 @@ dht* dht_setup(network *n)
         num = fread(sin, sizeof(sockaddr_in), num, f);
         fclose(f);
         for (uint i = 0; i < num; i++) {
-            dht_ping_node((const sockaddr *)&sin[i], sizeof(sockaddr_in));
+            dht_ping_later(d, (const sockaddr *)&sin[i], sizeof(sockaddr_in));
         }
         if (num) {
             debug("dht loaded num:%zu\n", num);
@@ -108,13 +163,26 @@ dht* dht_setup(network *n)
         num6 = fread(sin6, sizeof(sockaddr_in6), num6, f);
         fclose(f);
         for (uint i = 0; i < num6; i++) {
-            dht_ping_node((const sockaddr *)&sin6[i], sizeof(sockaddr_in6));
+            dht_ping_later(d, (const sockaddr *)&sin6[i], sizeof(sockaddr_in6));
         }
         if (num6) {
             debug("dht loaded num6:%zu\n", num6);
         }
     }
 
+    if (o_dht_bootstrap) {
+        // private network, for simulations
+        char host[256];
+        snprintf(host, sizeof(host), "%s", o_dht_bootstrap);
+        char *colon = strrchr(host, ':');
+        if (!colon) {
+            die("bad bootstrap address: %s\n", o_dht_bootstrap);
+        }
+        *colon = '\0';
+        dht_add_bootstrap(d, host, atoi(colon + 1));
+        return d;
+    }
+
     dht_add_bootstrap(d, "router.utorrent.com", 6881);
     dht_add_bootstrap(d, "router.bittorrent.com", 6881);
     dht_add_bootstrap(d, "dht.libtorrent.org", 25401);
@@ -124,10 +192,10 @@ dht* dht_setup(network *n)
 
 void dht_save(dht *d)
 {
-    if (time(NULL) - d->save_time < 5) {
+    if (vtime_time() - d->save_time < 5) {
         return;
     }
-    d->save_time = time(NULL);
+    d->save_time = vtime_time();
 
     sockaddr_in sin[2048];
     int num = lenof(sin);
@@ -206,6 +274,7 @@ void dht_announce(dht *d, const uint8_t *info_hash)
         return;
     }
     dht_filter(d);
+    PROBE2(dht_search_start, info_hash, sockaddr_get_port((sockaddr*)&sa));
     dht_search(info_hash, sockaddr_get_port((sockaddr*)&sa), AF_INET, dht_filter_event_callback, d->n);
     dht_search(info_hash, sockaddr_get_port((sockaddr*)&sa), AF_INET6, dht_filter_event_callback, d->n);
 }
@@ -213,12 +282,19 @@ void dht_announce(dht *d, const uint8_t *info_hash)
 void dht_get_peers(dht *d, const uint8_t *info_hash)
 {
     dht_filter(d);
+    PROBE2(dht_search_start, info_hash, 0);
     dht_search(info_hash, 0, AF_INET, dht_filter_event_callback, d->n);
     dht_search(info_hash, 0, AF_INET6, dht_filter_event_callback, d->n);
 }
 
 void dht_destroy(dht *d)
 {
+    // network_free() calls this without a dht, e.g. in injector workers
+    if (!d) {
+        return;
+    }
+    timer_stop(&d->ping_timer);
+    free(d->pings);
     dht_uninit();
     free(d);
 }
@@ -229,7 +305,12 @@ int dht_sendto(int sockfd, const void *buf, int len, int flags,
     // dht incorrectly passes sizeof(sockaddr_storage)
     tolen = sockaddr_get_length(to);
     ddebug("dht_sendto(%d, %s)\n", len, sockaddr_str(to));
-    return (int)udp_sendto(sockfd, buf, len, to, tolen);
+    int r = udp_sendto(sockfd, buf, len, to, tolen);
+    if (r >= 0) {
+        g_udp_stats.dht_sent_packets++;
+        g_udp_stats.dht_sent_bytes += r;
+    }
+    return r;
 }
 
 int dht_blacklisted(const sockaddr *sa, int salen)
@@ -10,12 +10,19 @@ typedef struct dht dht;
 
 typedef struct sockaddr sockaddr;
 
+// set before network_setup(): bootstrap from this "host:port" instead of the public routers
+extern const char *o_dht_bootstrap;
+// seconds between injector swarm announces and searches
+extern uint o_swarm_interval;
+
 dht* dht_setup(network *n);
 time_t dht_tick(dht *d);
 bool dht_process_udp(dht *d, const uint8_t *buffer, size_t len, const sockaddr *to, socklen_t tolen, time_t *tosleep);
 bool dht_process_icmp(dht *d, const uint8_t *buffer, size_t len, const sockaddr *to, socklen_t tolen, time_t *tosleep);
 void dht_announce(dht *d, const uint8_t *info_hash);
 void dht_get_peers(dht *d, const uint8_t *info_hash);
+// pinged soon, a few at a time, rather than right away
+void dht_ping_later(dht *d, const sockaddr *sa, socklen_t salen);
 size_t dht_num_searches(void);
 void dht_destroy(dht *d);
 
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <event2/buffer.h>
+
+#include "network.h"
+#include "histogram.h"
+
+
+uint histogram_bucket_index(uint64_t v)
+{
+    v = MIN(v, (1ULL << HISTOGRAM_MAX_BITS) - 1);
+    if (v < (1 << HISTOGRAM_SUB_BITS)) {
+        return (uint)v;
+    }
+    uint e = 63 - (uint)__builtin_clzll(v);
+    uint shift = e - HISTOGRAM_SUB_BITS;
+    uint m = (uint)(v >> shift) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) + m;
+}
+
+uint64_t histogram_bucket_upper(uint i)
+{
+    if (i < (1 << HISTOGRAM_SUB_BITS)) {
+        return i;
+    }
+    uint shift = (i >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t m = i & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return (((1ULL << HISTOGRAM_SUB_BITS) + m + 1) << shift) - 1;
+}
+
+void histogram_record(histogram *h, uint64_t value)
+{
+    h->counts[histogram_bucket_index(value)]++;
+    h->count++;
+    h->sum += value;
+    h->max = MAX(h->max, value);
+}
+
+uint64_t histogram_percentile(const histogram *h, double q)
+{
+    if (!h->count) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (double)h->count + 0.5);
+    rank = MAX(rank, 1);
+    uint64_t seen = 0;
+    for (uint i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            return MIN(histogram_bucket_upper(i), h->max);
+        }
+    }
+    return h->max;
+}
+
+void histogram_metrics(evbuffer *out, const char *name, const char *labels, const histogram *h)
+{
+    const char *quantiles[] = {"0.5", "0.9", "0.99", "0.999"};
+    const double qs[] = {0.5, 0.9, 0.99, 0.999};
+    const char *sep = labels ? "," : "";
+    labels = labels ?: "";
+    for (uint i = 0; i < lenof(qs); i++) {
+        evbuffer_add_printf(out, "%s{%s%squantile=\"%s\"} %"PRIu64"\n",
+                            name, labels, sep, quantiles[i], histogram_percentile(h, qs[i]));
+    }
+    if (*labels) {
+        evbuffer_add_printf(out, "%s_sum{%s} %"PRIu64"\n", name, labels, h->sum);
+        evbuffer_add_printf(out, "%s_count{%s} %"PRIu64"\n", name, labels, h->count);
+    } else {
+        evbuffer_add_printf(out, "%s_sum %"PRIu64"\n", name, h->sum);
+        evbuffer_add_printf(out, "%s_count %"PRIu64"\n", name, h->count);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+
+#include "network.h"
+
+
+// log-linear buckets: exact below 16, then 16 sub-buckets per power of two
+// (about 6% relative error), up to 2^32 (71 minutes of microseconds)
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_MAX_BITS 32
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} histogram;
+
+uint histogram_bucket_index(uint64_t value);
+uint64_t histogram_bucket_upper(uint index);
+
+void histogram_record(histogram *h, uint64_t value);
+uint64_t histogram_percentile(const histogram *h, double q);
+
+// Prometheus summary with p50/p90/p99/p999, _sum and _count
+void histogram_metrics(evbuffer *out, const char *name, const char *labels, const histogram *h);
+
+#endif // __HISTOGRAM_H__
@@ -17,6 +17,7 @@
 #include "base64.h"
 #include "timer.h"
 #include "network.h"
+#include "probes.h"
 #include "constants.h"
 #include "hash_table.h"
 #include "utp_bufferevent.h"
@@ -25,6 +26,17 @@
 
 evhttp_connection *connections[10];
 
+size_t connections_pooled()
+{
+    size_t pooled = 0;
+    for (size_t i = 0; i < lenof(connections); i++) {
+        if (connections[i]) {
+            pooled++;
+        }
+    }
+    return pooled;
+}
+
 void join_url_swarm(network *n, const char *url)
 {
     __block struct {
@@ -233,6 +245,7 @@ uint64 utp_on_accept(utp_callback_arguments *a)
     addr.ss_len = addrlen;
 #endif
     ddebug("utp_on_accept %p %s\n", a->socket, sockaddr_str((const sockaddr*)&addr));
+    PROBE2(utp_accept, a->socket, &addr);
     add_sockaddr(n, (sockaddr *)&addr, addrlen);
     int fd = utp_socket_create_fd(n->evbase, a->socket);
     evutil_make_socket_closeonexec(fd);
@@ -34,13 +34,14 @@ void overwrite_kv_header(evkeyvalq *out, const char *key, const char *value);
 void overwrite_header(evhttp_request *to, const char *key, const char *value);
 void copy_header(evhttp_request *from, evhttp_request *to, const char *key);
 void copy_all_headers(evhttp_request *from, evhttp_request *to);
-void hash_headers(evkeyvalq *in, crypto_generichash_state *content_state);
+size_t hash_headers(evkeyvalq *in, crypto_generichash_state *content_state);
 void hash_request(evhttp_request *req, evkeyvalq *hdrs, crypto_generichash_state *content_state);
 void merkle_tree_hash_request(merkle_tree *m, evhttp_request *req, evkeyvalq *hdrs);
 evbuffer* build_request_buffer(int response_code, evkeyvalq *hdrs);
 
 evhttp_connection *make_connection(network *n, const evhttp_uri *uri);
 void return_connection(evhttp_connection *evcon);
+size_t connections_pooled(void);
 
 uint64 utp_on_accept(utp_callback_arguments *a);
 
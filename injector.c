@@ -4,12 +4,20 @@
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/queue.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #include <sodium.h>
 
 #include <event2/buffer.h>
+#include <event2/listener.h>
 #include <event2/bufferevent.h>
 
 #include "dht/dht.h"
@@ -19,24 +27,56 @@
 #include "utp.h"
 #include "base64.h"
 #include "timer.h"
+#include "vtime.h"
 #include "network.h"
 #include "constants.h"
 #include "bev_splice.h"
 #include "merkle_tree.h"
 #include "utp_bufferevent.h"
 #include "http.h"
+#include "load.h"
+#include "hash_table.h"
+#include "metrics.h"
+#include "probes.h"
+#include "cost.h"
+#include "arena.h"
+
+
+// admission control: beyond these, requests wait (at most MAX_QUEUE_WAIT_MS) or are shed
+#define MAX_ACTIVE_REQUESTS 512
+#define MAX_CLIENT_REQUESTS 32
+#define MAX_QUEUED_REQUESTS 1024
+#define MAX_QUEUE_WAIT_MS 2000
 
+typedef struct {
+    char *host;
+    uint active;
+} client_slots;
+
+typedef struct admission {
+    network *n;
+    evhttp_request *req;
+    char *host;
+    timer timeout;
+    TAILQ_ENTRY(admission) next;
+} admission;
 
 typedef struct {
     network *n;
+    // p itself and authority
+    arena *arena;
     evhttp_request *server_req;
     evbuffer *pending_output;
     evhttp_connection *evcon;
+    client_slots *client;
 
     // XXX: remove after no X-Sign clients exist
     crypto_generichash_state content_state;
 
     merkle_tree *m;
+
+    char *authority;
+    request_cost cost;
 } proxy_request;
 
 unsigned char pk[crypto_sign_PUBLICKEYBYTES] = injector_pk;
@@ -46,6 +86,15 @@ unsigned char sk[crypto_sign_SECRETKEYBYTES] = injector_sk;
 unsigned char sk[crypto_sign_SECRETKEYBYTES];
 #endif
 
+uint32_t g_active_requests;
+uint32_t g_queued_requests;
+uint64_t g_requests;
+uint64_t g_shed_requests;
+uint8_t g_cpu;
+hash_table *g_clients;
+hash_table *g_cost_per_authority;
+TAILQ_HEAD(, admission) g_admission_queue;
+
 
 void dht_event_callback(void *closure, int event, const unsigned char *info_hash, const void *data, size_t data_len)
 {
@@ -63,10 +112,99 @@ void add_sockaddr(network *n, const sockaddr *addr, socklen_t addrlen)
 
 void submit_request(network *n, evhttp_request *server_req, evhttp_connection *evcon, const evhttp_uri *uri);
 
+void current_load(char *buf, size_t len)
+{
+    load_report l = {.active = g_active_requests, .queued = g_queued_requests, .cpu = g_cpu};
+    load_format(&l, buf, len);
+}
+
+void add_load_header(evhttp_request *req)
+{
+    char buf[64];
+    current_load(buf, sizeof(buf));
+    overwrite_header(req, LOAD_HEADER, buf);
+}
+
+const char* request_client(evhttp_request *req)
+{
+    char *host;
+    ev_uint16_t port;
+    evhttp_connection_get_peer(req->evcon, &host, &port);
+    return host ?: "";
+}
+
+client_slots* client_acquire(const char *host)
+{
+    client_slots *cs = hash_get(g_clients, host);
+    if (!cs) {
+        cs = alloc(client_slots);
+        cs->host = strdup(host);
+        hash_set(g_clients, cs->host, cs);
+    }
+    cs->active++;
+    g_active_requests++;
+    return cs;
+}
+
+bool client_can_start(const char *host)
+{
+    if (g_active_requests >= MAX_ACTIVE_REQUESTS) {
+        return false;
+    }
+    client_slots *cs = hash_get(g_clients, host);
+    return !cs || cs->active < MAX_CLIENT_REQUESTS;
+}
+
+void admission_pump(void);
+void content_sign(content_sig *sig, const uint8_t *content_hash);
+
+void client_release(client_slots *cs)
+{
+    g_active_requests--;
+    cs->active--;
+    if (!cs->active) {
+        hash_remove(g_clients, cs->host);
+        free(cs->host);
+        free(cs);
+    }
+    admission_pump();
+}
+
+void send_signed_reply(evhttp_request *req, int code, const char *reason)
+{
+    // set the code early so we can hash it
+    req->response_code = code;
+
+    // XXX: remove after no X-Sign clients exist
+    crypto_generichash_state content_state;
+    crypto_generichash_init(&content_state, NULL, 0, crypto_generichash_BYTES);
+    evbuffer *request_buf = build_request_buffer(req->response_code, req->output_headers);
+    evbuffer_hash_update(request_buf, &content_state);
+    evbuffer_free(request_buf);
+
+    uint8_t content_hash[crypto_generichash_BYTES];
+    crypto_generichash_final(&content_state, content_hash, sizeof(content_hash));
+    content_sig sig;
+    content_sign(&sig, content_hash);
+    size_t out_len;
+    char *b64_sig = base64_urlsafe_encode((uint8_t*)&sig, sizeof(sig), &out_len);
+    debug("returning sig for %s %d %s %s\n", evhttp_request_get_uri(req), code, reason, b64_sig);
+
+    // XXX: remove after no X-Sign clients exist
+    overwrite_header(req, "X-Sign", b64_sig);
+
+    overwrite_header(req, "X-MSign", b64_sig);
+    free(b64_sig);
+
+    add_load_header(req);
+
+    evhttp_send_reply(req, code, reason, NULL);
+}
+
 void content_sign(content_sig *sig, const uint8_t *content_hash)
 {
     // base64(sign("sign" + timestamp + hash(headers + content)))
-    time_t now = time(NULL);
+    time_t now = vtime_time();
     char ts[sizeof("2011-10-08T07:07:09Z")];
     strftime(ts, sizeof(ts), "%FT%TZ", gmtime(&now));
     assert(sizeof(ts) - 1 == strlen(ts));
@@ -75,6 +213,7 @@ void content_sign(content_sig *sig, const uint8_t *content_hash)
     memcpy(sig->timestamp, ts, sizeof(sig->timestamp));
     memcpy(sig->content_hash, content_hash, sizeof(sig->content_hash));
     crypto_sign_detached(sig->signature, NULL, (uint8_t*)sig->sign, sizeof(content_sig) - sizeof(sig->signature), sk);
+    PROBE1(injector_sign, content_hash);
 }
 
 void request_cleanup(proxy_request *p)
@@ -86,8 +225,17 @@ void request_cleanup(proxy_request *p)
     if (p->pending_output) {
         evbuffer_free(p->pending_output);
     }
+    p->cost.bytes_hashed += p->m->bytes_hashed;
+    p->cost.allocations += p->m->allocations;
     merkle_tree_free(p->m);
-    free(p);
+    p->cost.allocations += arena_mallocs(p->arena);
+    char cost[512];
+    cost_format(&p->cost, cost, sizeof(cost));
+    debug("p:%p cost %s %s\n", p, cost, p->authority);
+    cost_account(&g_cost_per_authority, p->authority, &p->cost);
+    client_slots *cs = p->client;
+    arena_free(p->arena);
+    client_release(cs);
 }
 
 void request_done_cb(evhttp_request *req, void *arg)
@@ -109,8 +257,10 @@ void request_done_cb(evhttp_request *req, void *arg)
             crypto_generichash_final(&p->content_state, content_hash, sizeof(content_hash));
             content_sig sig;
             content_sign(&sig, content_hash);
+            p->cost.signatures++;
             size_t out_len;
             b64_sign = base64_urlsafe_encode((uint8_t*)&sig, sizeof(sig), &out_len);
+            p->cost.allocations++;
             debug("returning X-Sign for %s %s\n", uri, b64_sign);
         }
 
@@ -118,8 +268,10 @@ void request_done_cb(evhttp_request *req, void *arg)
         merkle_tree_get_root(p->m, root_hash);
         content_sig sig;
         content_sign(&sig, root_hash);
+        p->cost.signatures++;
         size_t out_len;
         char *b64_msign = base64_urlsafe_encode((uint8_t*)&sig, sizeof(sig), &out_len);
+        p->cost.allocations++;
         debug("returning X-MSign for %s %s\n", uri, b64_msign);
 
         evhttp_add_header(p->server_req->output_headers, "X-Sign", b64_sign);
@@ -133,6 +285,7 @@ void request_done_cb(evhttp_request *req, void *arg)
             static_assert(sizeof(node) == member_sizeof(node, hash), "node hash packing");
             size_t node_len = p->m->leaves_num * member_sizeof(node, hash);
             b64_hashes = base64_urlsafe_encode((uint8_t*)p->m->nodes, node_len, &out_len);
+            p->cost.allocations++;
             evhttp_add_header(p->server_req->output_headers, "X-Hashes", b64_hashes);
             free(b64_hashes);
         }
@@ -142,8 +295,10 @@ void request_done_cb(evhttp_request *req, void *arg)
         if (ifnonematch) {
             size_t content_etag_len;
             char *content_etag = base64_urlsafe_encode((uint8_t*)&content_hash, sizeof(content_hash), &content_etag_len);
+            p->cost.allocations++;
             size_t root_etag_len;
             char *root_etag = base64_urlsafe_encode((uint8_t*)&root_hash, sizeof(root_hash), &root_etag_len);
+            p->cost.allocations++;
             size_t if_len = strlen(ifnonematch);
             if (if_len > 0) {
                 if (ifnonematch[if_len - 1] == '"') {
@@ -180,16 +335,22 @@ void chunked_cb(evhttp_request *req, void *arg)
     evbuffer *input = req->input_buffer;
     //debug("p:%p chunked_cb length:%zu\n", p, evbuffer_get_length(input));
 
+    // X-Sign. the merkle tree counts its own
+    p->cost.bytes_hashed += evbuffer_get_length(input);
     evbuffer_hash_update(input, &p->content_state);
     merkle_tree_add_evbuffer(p->m, input);
     if (!p->pending_output) {
         p->pending_output = evbuffer_new();
+        p->cost.allocations++;
     }
     evbuffer_add_buffer(p->pending_output, input);
+    cost_buffered(&p->cost, evbuffer_get_length(p->pending_output));
 }
 
-void hash_headers(evkeyvalq *in, crypto_generichash_state *content_state)
+// returns the number of bytes hashed
+size_t hash_headers(evkeyvalq *in, crypto_generichash_state *content_state)
 {
+    size_t hashed = 0;
     const char *headers[] = hashed_headers;
     for (size_t i = 0; i < lenof(headers); i++) {
         const char *key = headers[i];
@@ -200,7 +361,9 @@ void hash_headers(evkeyvalq *in, crypto_generichash_state *content_state)
         char buf[1024];
         snprintf(buf, sizeof(buf), "%s: %s\r\n", key, value);
         crypto_generichash_update(content_state, (const uint8_t *)buf, strlen(buf));
+        hashed += strlen(buf);
     }
+    return hashed;
 }
 
 int header_cb(evhttp_request *req, void *arg)
@@ -215,13 +378,14 @@ int header_cb(evhttp_request *req, void *arg)
         copy_header(req, p->server_req, response_header_whitelist[i]);
     }
     overwrite_header(p->server_req, "Content-Location", evhttp_request_get_uri(p->server_req));
+    add_load_header(p->server_req);
 
     char *content_length = (char*)evhttp_find_header(req->input_headers, "Content-Length");
     debug("Content-Length:%s uri:%s\n", content_length, evhttp_request_get_uri(p->server_req));
 
     // XXX: remove after no X-Sign clients exist
     crypto_generichash_init(&p->content_state, NULL, 0, crypto_generichash_BYTES);
-    hash_headers(p->server_req->output_headers, &p->content_state);
+    p->cost.bytes_hashed += hash_headers(p->server_req->output_headers, &p->content_state);
 
     merkle_tree_hash_request(p->m, req, p->server_req->output_headers);
 
@@ -250,12 +414,19 @@ void error_cb(evhttp_request_error error, void *arg)
 
 void submit_request(network *n, evhttp_request *server_req, evhttp_connection *evcon, const evhttp_uri *uri)
 {
-    proxy_request *p = alloc(proxy_request);
+    arena *a = arena_new(sizeof(proxy_request) + 256);
+    proxy_request *p = arena_alloc(a, sizeof(proxy_request));
+    p->arena = a;
     p->n = n;
     p->server_req = server_req;
+    p->client = client_acquire(request_client(server_req));
     p->evcon = evcon;
     p->m = alloc(merkle_tree);
+    p->cost.allocations++;
+    p->authority = arena_strdup(p->arena, evhttp_uri_get_host(uri) ?: "");
     evhttp_request *client_req = evhttp_request_new(request_done_cb, p);
+    // the arena's are counted at cleanup
+    p->cost.allocations++;
     const char *request_header_whitelist[] = {"Referer", "Host", "Origin"};
     for (size_t i = 0; i < lenof(request_header_whitelist); i++) {
         copy_header(p->server_req, client_req, request_header_whitelist[i]);
@@ -280,6 +451,7 @@ void submit_request(network *n, evhttp_request *server_req, evhttp_connection *e
 typedef struct {
     evhttp_request *server_req;
     bufferevent *direct;
+    client_slots *client;
 } connect_req;
 
 void connect_cleanup(connect_req *c, int err)
@@ -304,33 +476,11 @@ void connect_cleanup(connect_req *c, int err)
         case ETIMEDOUT: code = 504; reason = "Gateway Timeout"; break;
         }
 
-        // set the code early so we can hash it
-        c->server_req->response_code = code;
-
-        // XXX: remove after no X-Sign clients exist
-        crypto_generichash_state content_state;
-        crypto_generichash_init(&content_state, NULL, 0, crypto_generichash_BYTES);
-        evbuffer *request_buf = build_request_buffer(c->server_req->response_code, c->server_req->output_headers);
-        evbuffer_hash_update(request_buf, &content_state);
-        evbuffer_free(request_buf);
-
-        uint8_t content_hash[crypto_generichash_BYTES];
-        crypto_generichash_final(&content_state, content_hash, sizeof(content_hash));
-        content_sig sig;
-        content_sign(&sig, content_hash);
-        size_t out_len;
-        char *b64_sig = base64_urlsafe_encode((uint8_t*)&sig, sizeof(sig), &out_len);
-        debug("returning sig for %s %d %s %s\n", evhttp_request_get_uri(c->server_req), code, reason, b64_sig);
-
-        // XXX: remove after no X-Sign clients exist
-        overwrite_header(c->server_req, "X-Sign", b64_sig);
-
-        overwrite_header(c->server_req, "X-MSign", b64_sig);
-        free(b64_sig);
-
-        evhttp_send_reply(c->server_req, code, reason, NULL);
+        send_signed_reply(c->server_req, code, reason);
     }
+    client_slots *cs = c->client;
     free(c);
+    client_release(cs);
 }
 
 void connected(connect_req *c, bufferevent *other)
@@ -339,7 +489,9 @@ void connected(connect_req *c, bufferevent *other)
     evhttp_connection_set_closecb(c->server_req->evcon, NULL, NULL);
     c->server_req = NULL;
     connect_cleanup(c, 0);
-    evbuffer_add_printf(bufferevent_get_output(bev), "HTTP/1.0 200 Connection established\r\n\r\n");
+    char load[64];
+    current_load(load, sizeof(load));
+    evbuffer_add_printf(bufferevent_get_output(bev), "HTTP/1.0 200 Connection established\r\n" LOAD_HEADER ": %s\r\n\r\n", load);
     bev_splice(bev, other);
     bufferevent_enable(bev, EV_READ|EV_WRITE);
 }
@@ -398,6 +550,7 @@ void connect_request(network *n, evhttp_request *req)
 
     connect_req *c = alloc(connect_req);
     c->server_req = req;
+    c->client = client_acquire(request_client(req));
 
     evhttp_connection_set_closecb(req->evcon, close_cb, c);
 
@@ -410,6 +563,125 @@ void connect_request(network *n, evhttp_request *req)
     evhttp_uri_free(uri);
 }
 
+void start_request(network *n, evhttp_request *req)
+{
+    if (req->type == EVHTTP_REQ_CONNECT) {
+        connect_request(n, req);
+        return;
+    }
+
+    const evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
+    // TODO: could look up uri in a table of {uri => headers}
+    evhttp_connection *evcon = make_connection(n, uri);
+    if (!evcon) {
+        evhttp_send_error(req, 503, "Service Unavailable");
+        return;
+    }
+
+    submit_request(n, req, evcon, uri);
+}
+
+void send_busy(evhttp_request *req)
+{
+    g_shed_requests++;
+    if (req->type == EVHTTP_REQ_CONNECT) {
+        char buf[2048];
+        snprintf(buf, sizeof(buf), "https://%s", evhttp_request_get_uri(req));
+        overwrite_header(req, "Content-Location", buf);
+    } else {
+        overwrite_header(req, "Content-Location", evhttp_request_get_uri(req));
+    }
+    // a signed 503 tells the client to try another injector
+    send_signed_reply(req, 503, "Injector Busy");
+}
+
+void admission_free(admission *a)
+{
+    TAILQ_REMOVE(&g_admission_queue, a, next);
+    g_queued_requests--;
+    timer_stop(&a->timeout);
+    if (a->req) {
+        evhttp_connection_set_closecb(a->req->evcon, NULL, NULL);
+    }
+    free(a->host);
+    free(a);
+}
+
+void admission_close_cb(evhttp_connection *evcon, void *ctx)
+{
+    admission *a = (admission *)ctx;
+    debug("a:%p %s\n", a, __func__);
+    // the request is freed along with the connection
+    a->req = NULL;
+    admission_free(a);
+}
+
+void admission_timeout_cb(void *arg)
+{
+    admission *a = (admission *)arg;
+    debug("a:%p shedding %s after %dms\n", a, evhttp_request_get_uri(a->req), MAX_QUEUE_WAIT_MS);
+    evhttp_request *r = a->req;
+    admission_free(a);
+    send_busy(r);
+}
+
+void admission_pump()
+{
+    // starting a request can finish another one synchronously
+    static bool pumping;
+    if (pumping) {
+        return;
+    }
+    pumping = true;
+    admission *a = TAILQ_FIRST(&g_admission_queue);
+    while (a && g_active_requests < MAX_ACTIVE_REQUESTS) {
+        if (!client_can_start(a->host)) {
+            a = TAILQ_NEXT(a, next);
+            continue;
+        }
+        network *n = a->n;
+        evhttp_request *req = a->req;
+        admission_free(a);
+        start_request(n, req);
+        a = TAILQ_FIRST(&g_admission_queue);
+    }
+    pumping = false;
+}
+
+void admit_request(network *n, evhttp_request *req)
+{
+    const char *host = request_client(req);
+    if (client_can_start(host)) {
+        start_request(n, req);
+        return;
+    }
+    if (g_queued_requests >= MAX_QUEUED_REQUESTS) {
+        debug("shedding %s from %s (queued:%u)\n", evhttp_request_get_uri(req), host, g_queued_requests);
+        send_busy(req);
+        return;
+    }
+    admission *a = alloc(admission);
+    a->n = n;
+    a->req = req;
+    a->host = strdup(host);
+    TAILQ_INSERT_TAIL(&g_admission_queue, a, next);
+    g_queued_requests++;
+    evhttp_connection_set_closecb(req->evcon, admission_close_cb, a);
+    timer_init(&a->timeout, n, admission_timeout_cb, a);
+    timer_schedule(&a->timeout, MAX_QUEUE_WAIT_MS);
+}
+
+void injector_metrics(network *n, evbuffer *out)
+{
+    metrics_counter(out, "newnode_injector_requests_total", "requests received", g_requests);
+    metrics_counter(out, "newnode_injector_shed_total", "requests answered busy", g_shed_requests);
+    metrics_gauge(out, "newnode_injector_active_requests", "admitted requests", g_active_requests);
+    metrics_gauge(out, "newnode_injector_queued_requests", "requests waiting for admission", g_queued_requests);
+    metrics_gauge(out, "newnode_injector_clients", "clients with admitted requests", hash_length(g_clients));
+    metrics_gauge(out, "newnode_injector_cpu_percent", "cpu use over the last second", g_cpu);
+    network_metrics(n, out);
+}
+
 void http_request_cb(evhttp_request *req, void *arg)
 {
     network *n = (network*)arg;
@@ -419,8 +691,25 @@ void http_request_cb(evhttp_request *req, void *arg)
     debug("con:%p %s:%u request received %s %s\n", req->evcon, e_host, e_port,
         evhttp_method(req->type), evhttp_request_get_uri(req));
 
-    if (req->type == EVHTTP_REQ_CONNECT) {
-        connect_request(n, req);
+    g_requests++;
+
+    if (req->type == EVHTTP_REQ_GET && streq(evhttp_request_get_uri(req), "/metrics") &&
+        bufferevent_is_localhost(evhttp_connection_get_bufferevent(req->evcon))) {
+        evhttp_add_header(req->output_headers, "Content-Type", "text/plain; version=0.0.4");
+        evbuffer *body = evbuffer_new();
+        injector_metrics(n, body);
+        evhttp_send_reply(req, 200, "OK", body);
+        evbuffer_free(body);
+        return;
+    }
+
+    if (req->type == EVHTTP_REQ_GET && streq(evhttp_request_get_uri(req), "/debug/cost") &&
+        bufferevent_is_localhost(evhttp_connection_get_bufferevent(req->evcon))) {
+        evhttp_add_header(req->output_headers, "Content-Type", "text/plain");
+        evbuffer *body = evbuffer_new();
+        cost_report(g_cost_per_authority, body);
+        evhttp_send_reply(req, 200, "OK", body);
+        evbuffer_free(body);
         return;
     }
 
@@ -488,20 +777,14 @@ void http_request_cb(evhttp_request *req, void *arg)
         evhttp_add_header(req->output_headers, "X-MSign", b64_msign);
         free(b64_msign);
 
+        add_load_header(req);
+
         evhttp_send_reply(req, 200, "OK", output);
         evbuffer_free(output);
         return;
     }
 
-    const evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
-    // TODO: could look up uri in a table of {uri => headers}
-    evhttp_connection *evcon = make_connection(n, uri);
-    if (!evcon) {
-        evhttp_send_error(req, 503, "Service Unavailable");
-        return;
-    }
-
-    submit_request(n, req, evcon, uri);
+    admit_request(n, req);
 }
 
 void usage(char *name)
@@ -510,33 +793,152 @@ void usage(char *name)
     fprintf(stderr, "    %s [options] -p <listening-port>\n", name);
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "    -s <IP>     Source IP\n");
+    fprintf(stderr, "    -b <host:port>  DHT bootstrap node, instead of the public routers\n");
+    fprintf(stderr, "    -r <seconds>    Interval between swarm announces (default 1500)\n");
+    fprintf(stderr, "    -s <IP>         Source IP\n");
+    fprintf(stderr, "    -S <seed>       Deterministic virtual-time mode, for tests\n");
+    fprintf(stderr, "                    <seed>,<epoch> also sets the virtual start time\n");
+    fprintf(stderr, "    -w <N>          Worker processes sharing the ports (default 1)\n");
     fprintf(stderr, "\n");
     exit(1);
 }
 
+pid_t *g_worker_pids;
+uint g_workers;
+volatile sig_atomic_t g_supervisor_signal;
+
+void supervisor_signal(int sig)
+{
+    // PR_SET_PDEATHSIG is linux only, so the workers are stopped explicitly
+    g_supervisor_signal = sig;
+    for (uint i = 0; i < g_workers; i++) {
+        if (g_worker_pids[i]) {
+            kill(g_worker_pids[i], sig);
+        }
+    }
+}
+
+int supervise(uint workers)
+{
+    // non-dht packets which land on other workers are forwarded to worker 0
+    int forward[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, forward) != 0) {
+        pdie("socketpair");
+    }
+    pid_t *pids = calloc(workers, sizeof(pid_t));
+    g_worker_pids = pids;
+    g_workers = workers;
+    // no SA_RESTART, so waitpid() returns to check g_supervisor_signal
+    struct sigaction sa = {.sa_handler = supervisor_signal};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    for (;;) {
+        for (uint i = 0; i < workers; i++) {
+            if (pids[i] || g_supervisor_signal) {
+                continue;
+            }
+            pid_t pid = fork();
+            if (pid < 0) {
+                pdie("fork");
+            }
+            if (!pid) {
+#ifdef __linux__
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+                signal(SIGTERM, SIG_DFL);
+                signal(SIGINT, SIG_DFL);
+                g_worker_pids = NULL;
+                g_workers = 0;
+                free(pids);
+                o_reuseport = true;
+                if (i == 0) {
+                    close(forward[1]);
+                    o_dht_forward_fd = -1;
+                    return forward[0];
+                }
+                close(forward[0]);
+                o_dht_forward_fd = forward[1];
+                return -1;
+            }
+            debug("worker %u started pid:%d\n", i, pid);
+            pids[i] = pid;
+            if (g_supervisor_signal) {
+                // arrived before the pid was recorded
+                kill(pid, g_supervisor_signal);
+            }
+        }
+        if (g_supervisor_signal) {
+            bool running = false;
+            for (uint i = 0; i < workers; i++) {
+                running |= pids[i] != 0;
+            }
+            if (!running) {
+                int sig = g_supervisor_signal;
+                debug("workers stopped, exiting on signal %d\n", sig);
+                signal(sig, SIG_DFL);
+                raise(sig);
+            }
+        }
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            pdie("waitpid");
+        }
+        for (uint i = 0; i < workers; i++) {
+            if (pids[i] == pid) {
+                if (!g_supervisor_signal) {
+                    fprintf(stderr, "worker %u pid:%d exited status:%d, restarting\n", i, pid, status);
+                }
+                pids[i] = 0;
+            }
+        }
+        if (g_supervisor_signal) {
+            continue;
+        }
+        // don't spin if workers die immediately
+        sleep(1);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     char *address = "::";
     char *port_s = NULL;
+    uint workers = 1;
 
     o_debug = 0;
 
     for (;;) {
-        int c = getopt(argc, argv, "p:s:v");
+        int c = getopt(argc, argv, "b:p:r:s:S:vw:");
         if (c == -1) {
             break;
         }
         switch (c) {
+        case 'b':
+            o_dht_bootstrap = optarg;
+            break;
         case 'p':
             port_s = optarg;
             break;
+        case 'r':
+            o_swarm_interval = MAX(atoi(optarg), 1);
+            break;
         case 's':
             address = optarg;
             break;
+        case 'S':
+            vtime_setup(optarg);
+            break;
         case 'v':
             o_debug++;
             break;
+        case 'w':
+            workers = MAX(atoi(optarg), 1);
+            break;
         default:
             die("Unhandled argument: %c\n", c);
         }
@@ -562,7 +964,22 @@ int main(int argc, char *argv[])
 #endif
 
     port_t port = atoi(port_s);
+
+    g_clients = hash_table_create();
+    TAILQ_INIT(&g_admission_queue);
+
+    // only one worker (or the only process) announces and runs the dht
+    int dht_owner_fd = -1;
+    bool dht_owner = true;
+    if (workers > 1) {
+        dht_owner_fd = supervise(workers);
+        dht_owner = dht_owner_fd != -1;
+    }
+
     network *n = network_setup(address, port);
+    if (dht_owner_fd != -1) {
+        network_accept_forwarded(n, dht_owner_fd);
+    }
 
     timer_callback cb = ^{
 #define SHA1BA(a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,q,r,s,t) (const uint8_t[]){0x##a,0x##b,0x##c,0x##d,0x##e,0x##f,0x##g,0x##h,0x##i,0x##j,0x##k,0x##l,0x##m,0x##n,0x##o,0x##p,0x##q,0x##r,0x##s,0x##t}
@@ -578,9 +995,10 @@ static_assert(20 >= crypto_generichash_BYTES_MIN, "dht hash must fit in generich
         uint8_t encrypted_injector_swarm_p0[20];
         uint8_t encrypted_injector_swarm_p1[20];
 
-        time_t t = time(NULL);
+        time_t t = vtime_time();
         tm *tm = gmtime(&t);
         char name[1024];
+        debug("announcing injector %d-%d..%d\n", tm->tm_year, tm->tm_yday - 1, tm->tm_yday + 1);
 
         snprintf(name, sizeof(name), "injector %d-%d", tm->tm_year, (tm->tm_yday - 1));
         crypto_generichash(encrypted_injector_swarm_m1, sizeof(encrypted_injector_swarm_m1), (uint8_t*)name, strlen(name), NULL, 0);
@@ -592,12 +1010,37 @@ static_assert(20 >= crypto_generichash_BYTES_MIN, "dht hash must fit in generich
         crypto_generichash(encrypted_injector_swarm_p1, sizeof(encrypted_injector_swarm_p1), (uint8_t*)name, strlen(name), NULL, 0);
         dht_announce(n->dht, (const uint8_t *)encrypted_injector_swarm_p1);
     };
-    cb();
-    timer_repeating(n, 25 * 60 * 1000, cb);
+    if (dht_owner) {
+        cb();
+        timer_repeating(n, o_swarm_interval * 1000, cb);
+    }
+
+    load_cpu_sample();
+    timer_repeating(n, 1000, ^{
+        g_cpu = load_cpu_sample();
+    });
 
     evhttp_set_allowed_methods(n->http, EVHTTP_REQ_GET | EVHTTP_REQ_CONNECT | EVHTTP_REQ_TRACE | EVHTTP_REQ_OPTIONS);
     evhttp_set_gencb(n->http, http_request_cb, n);
-    evhttp_bind_socket_with_handle(n->http, "127.0.0.1", port);
+    if (o_reuseport) {
+        sockaddr_in sin = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = inet_addr("127.0.0.1"),
+            .sin_port = htons(port),
+#ifdef __APPLE__
+            .sin_len = sizeof(sin)
+#endif
+        };
+        evconnlistener *listener = evconnlistener_new_bind(n->evbase, NULL, NULL,
+            LEV_OPT_CLOSE_ON_FREE|LEV_OPT_CLOSE_ON_EXEC|LEV_OPT_REUSEABLE|LEV_OPT_REUSEABLE_PORT, -1,
+            (sockaddr *)&sin, sizeof(sin));
+        if (!listener) {
+            pdie("evconnlistener_new_bind");
+        }
+        evhttp_bind_listener(n->http, listener);
+    } else {
+        evhttp_bind_socket_with_handle(n->http, "127.0.0.1", port);
+    }
     printf("listening on TCP: %s:%d\n", "127.0.0.1", port);
 
     return network_loop(n);
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "network.h"
+#include "load.h"
+
+
+void load_format(const load_report *l, char *buf, size_t len)
+{
+    snprintf(buf, len, "a=%u q=%u c=%u", l->active, l->queued, l->cpu);
+}
+
+bool load_parse(const char *s, load_report *l)
+{
+    uint active;
+    uint queued;
+    uint cpu;
+    if (!s || sscanf(s, "a=%u q=%u c=%u", &active, &queued, &cpu) != 3) {
+        return false;
+    }
+    l->active = active;
+    l->queued = queued;
+    l->cpu = (uint8_t)MIN(cpu, 100);
+    return true;
+}
+
+uint8_t load_score(const load_report *l)
+{
+    // a queued request costs a client more than a busy cpu or an active request does
+    uint64_t score = (uint64_t)l->cpu + l->active + 4 * (uint64_t)l->queued;
+    return (uint8_t)MIN(score, 0xFF);
+}
+
+uint8_t load_update(uint8_t load, uint8_t score)
+{
+    return (uint8_t)((load + 3 * (uint)score) / 4);
+}
+
+uint8_t load_cpu_sample()
+{
+    static uint64_t last_cpu_us;
+    static uint64_t last_wall_us;
+
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    uint64_t cpu_us = (uint64_t)ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec +
+                      (uint64_t)ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec;
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t wall_us = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+
+    uint8_t cpu = 0;
+    if (last_wall_us && wall_us > last_wall_us) {
+        cpu = (uint8_t)MIN(100 * (cpu_us - last_cpu_us) / (wall_us - last_wall_us), 100);
+    }
+    last_cpu_us = cpu_us;
+    last_wall_us = wall_us;
+    return cpu;
+}
@@ -0,0 +1,30 @@
+#ifndef __LOAD_H__
+#define __LOAD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// not part of hashed_headers, so it can be added to any (already signed) response
+#define LOAD_HEADER "X-Load"
+
+// reported load halves every LOAD_HALF_LIFE seconds without a new report
+#define LOAD_HALF_LIFE 60
+
+// score given to an injector which shed a request
+#define LOAD_BUSY 0xFF
+
+typedef struct {
+    uint32_t active;
+    uint32_t queued;
+    uint8_t cpu;
+} load_report;
+
+void load_format(const load_report *l, char *buf, size_t len);
+bool load_parse(const char *s, load_report *l);
+uint8_t load_score(const load_report *l);
+uint8_t load_update(uint8_t load, uint8_t score);
+uint8_t load_cpu_sample(void);
+
+#endif // __LOAD_H__
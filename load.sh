@@ -0,0 +1,92 @@
+#!/bin/bash
+
+# Load test on loopback: a native origin, injectors and clients on one box, no network needed.
+# Build with `DEBUG=1 ./build.sh` so the injector signs with the built-in test key.
+#
+#   INJECTORS=2 INJECTOR_WORKERS=4 CLIENTS=4 ./load.sh -c 64 -n 20000 -s 1024:60,65536:30,4194304:10 -C 20
+#
+# Arguments are passed to loadgen (see ./loadgen -h). TARGET=injectors sends the load
+# to the injectors directly instead of through the clients. CONNECT needs the origin
+# to listen on 443, which is skipped when that port can't be bound.
+
+set -e
+
+ORIGIN_PORT=${ORIGIN_PORT:-8000}
+INJECTOR_PORT=${INJECTOR_PORT:-8005}
+CLIENT_PORT=${CLIENT_PORT:-8100}
+INJECTORS=${INJECTORS:-1}
+INJECTOR_WORKERS=${INJECTOR_WORKERS:-1}
+CLIENTS=${CLIENTS:-2}
+TARGET=${TARGET:-clients}
+
+BIN=$(cd $(dirname $0) && pwd)
+WORK=$(mktemp -d)
+
+function cleanup {
+    kill -SIGTERM $(jobs -pr) 2>/dev/null || true
+    rm -rf $WORK
+}
+trap cleanup EXIT
+trap 'exit 1' HUP INT TERM
+
+function now {
+    date +'%M:%S'
+}
+
+function wait_port {
+    for i in $(seq 100); do
+        if (echo > /dev/tcp/127.0.0.1/$1) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "$(now) port $1 did not open"
+    return 1
+}
+
+#-------------------------------------------------------------------------------
+echo "$(now) Starting origin."
+$BIN/loadgen -O $ORIGIN_PORT,443 > $WORK/origin.log 2>&1 &
+sleep 0.2
+if ! kill -0 $! 2>/dev/null; then
+    echo "$(now) can't bind 443, CONNECT requests will fail."
+    $BIN/loadgen -O $ORIGIN_PORT > $WORK/origin.log 2>&1 &
+fi
+wait_port $ORIGIN_PORT
+
+#-------------------------------------------------------------------------------
+injectors=()
+for i in $(seq 0 $((INJECTORS - 1))); do
+    port=$((INJECTOR_PORT + i))
+    mkdir -p $WORK/injector$i
+    echo "$(now) Starting injector on $port with $INJECTOR_WORKERS workers."
+    (cd $WORK/injector$i && exec $BIN/injector -p $port -w $INJECTOR_WORKERS > log 2>&1) &
+    wait_port $port
+    injectors+=("127.0.0.1:$port")
+done
+
+#-------------------------------------------------------------------------------
+clients=()
+injector_args=$(printf -- "-i %s " "${injectors[@]}")
+for i in $(seq 0 $((CLIENTS - 1))); do
+    # clients take two ports, http and socks
+    port=$((CLIENT_PORT + 2 * i))
+    mkdir -p $WORK/client$i
+    echo "$(now) Starting client on $port."
+    (cd $WORK/client$i && exec $BIN/client -p $port $injector_args > log 2>&1) &
+    wait_port $port
+    clients+=("127.0.0.1:$port")
+done
+
+#-------------------------------------------------------------------------------
+if [ $TARGET = injectors ]; then
+    proxies=$(IFS=,; echo "${injectors[*]}")
+else
+    proxies=$(IFS=,; echo "${clients[*]}")
+fi
+echo "$(now) Running load through $proxies."
+r=0
+$BIN/loadgen -u 127.0.0.1:$ORIGIN_PORT -x $proxies "$@" || r=$?
+
+echo "$(now) DONE"
+exit $r
@@ -0,0 +1,758 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include <sodium.h>
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/http.h>
+#include <event2/http_struct.h>
+#include <event2/keyvalq_struct.h>
+
+#include "log.h"
+#include "http.h"
+#include "base64.h"
+#include "network.h"
+#include "histogram.h"
+#include "merkle_tree.h"
+
+
+// loopback load generator, and the origin server it fetches from.
+//
+//   loadgen -O 8000[,443]
+//     origin: GET /obj/<bytes>[?anything] returns <bytes> of fixed content. each port is
+//     on 127.0.0.1 unless given as <addr>:<port>.
+//
+//   loadgen -u 127.0.0.1:8000 -x 127.0.0.1:8006[,127.0.0.1:8008...] [options]
+//     driver: keeps -c requests in flight, workers spread round robin over
+//     the proxies, until -n requests are done or -d seconds pass. -C percent of them are
+//     CONNECT tunnels to -t, with the object fetched through the tunnel.
+//     prints one JSON line per workload (http, revalidate, connect, all).
+//
+//   loadgen -u ... -x ... -k -N 100 -P
+//     populate: fetches every cacheable object (-N per size) once, so a following -k run
+//     measures cache hits. -R percent of those are revalidations, sent with the
+//     If-None-Match a client uses for the object, which only succeed as 304.
+//
+//   loadgen -u ... -x ... -r trace [-X speed]
+//     replay: issues the requests of a client trace (client -T) at their recorded times,
+//     -X times faster, each for a synthetic object of the recorded size. the origin
+//     answers Range requests, so ranged requests keep their shape.
+
+#define ORIGIN_MAX_OBJECT (1024 * 1024 * 1024)
+
+typedef struct {
+    char host[256];
+    port_t port;
+    sockaddr_storage ss;
+    int sslen;
+} endpoint;
+
+typedef struct {
+    uint64_t size;
+    uint weight;
+    // base64 merkle roots for If-None-Match, one per object (-N), filled in as they're used
+    char **etags;
+} object_size;
+
+typedef struct {
+    const char *name;
+    histogram latency;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytes;
+} workload;
+
+typedef struct {
+    uint64_t start_ms;
+    char method[16];
+    uint64_t bytes;
+    bool range;
+    uint64_t range_start;
+    uint64_t range_end;
+    char url[32];
+} trace_entry;
+
+typedef enum {
+    TUNNEL_CONNECTING,
+    TUNNEL_HEADERS,
+    TUNNEL_BODY,
+} tunnel_state;
+
+typedef struct {
+    const endpoint *proxy;
+    uint64_t start;
+    object_size *object;
+    // If-None-Match for revalidate requests
+    const char *etag;
+    const trace_entry *entry;
+    uint64_t size;
+    uint64_t received;
+    workload *w;
+    bufferevent *bev;
+    tunnel_state state;
+} worker;
+
+event_base *g_evbase;
+
+uint8_t g_content[64 * 1024];
+
+endpoint g_origin;
+endpoint g_tunnel;
+endpoint *g_proxies;
+uint g_proxies_len;
+object_size *g_sizes;
+uint g_sizes_len;
+uint g_sizes_weight;
+
+workload g_http = {.name = "http"};
+workload g_revalidate = {.name = "revalidate"};
+workload g_connect = {.name = "connect"};
+
+trace_entry *g_trace;
+size_t g_trace_len;
+uint64_t g_replayed;
+
+uint64_t g_issued;
+uint g_active;
+uint64_t g_start;
+uint64_t g_deadline;
+
+uint o_concurrency = 16;
+uint64_t o_requests = 1000;
+double o_duration = 0;
+uint o_connect_pct = 0;
+bool o_stable_urls = false;
+uint o_objects = 1;
+bool o_populate = false;
+uint o_revalidate_pct = 0;
+double o_speed = 1;
+
+
+uint64_t us_clock()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+bool parse_endpoint(const char *s, endpoint *e)
+{
+    const char *colon = strrchr(s, ':');
+    if (!colon || (size_t)(colon - s) >= sizeof(e->host)) {
+        return false;
+    }
+    snprintf(e->host, sizeof(e->host), "%.*s", (int)(colon - s), s);
+    e->port = (port_t)atoi(colon + 1);
+    e->sslen = sizeof(e->ss);
+    return !evutil_parse_sockaddr_port(s, (sockaddr *)&e->ss, &e->sslen);
+}
+
+endpoint* parse_endpoints(char *s, uint *len)
+{
+    endpoint *e = NULL;
+    *len = 0;
+    for (char *tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        e = realloc(e, (*len + 1) * sizeof(endpoint));
+        if (!parse_endpoint(tok, &e[*len])) {
+            die("bad address: %s\n", tok);
+        }
+        (*len)++;
+    }
+    return e;
+}
+
+void parse_sizes(char *s)
+{
+    // size[:weight],...
+    for (char *tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        g_sizes = realloc(g_sizes, (g_sizes_len + 1) * sizeof(object_size));
+        object_size *o = &g_sizes[g_sizes_len++];
+        char *colon = strchr(tok, ':');
+        o->size = strtoull(tok, NULL, 10);
+        o->weight = colon ? (uint)atoi(colon + 1) : 1;
+        if (o->size > ORIGIN_MAX_OBJECT) {
+            die("object too large: %s\n", tok);
+        }
+        g_sizes_weight += o->weight;
+    }
+}
+
+object_size* pick_size()
+{
+    uint r = (uint)random() % MAX(g_sizes_weight, 1);
+    for (uint i = 0; i < g_sizes_len; i++) {
+        if (r < g_sizes[i].weight) {
+            return &g_sizes[i];
+        }
+        r -= g_sizes[i].weight;
+    }
+    return &g_sizes[0];
+}
+
+void fill_content()
+{
+    for (size_t i = 0; i < sizeof(g_content); i++) {
+        g_content[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+}
+
+// the root the injector signs: its response headers (see build_request_buffer()), then the content
+char* content_etag(uint64_t size, const char *url)
+{
+    evkeyvalq headers;
+    TAILQ_INIT(&headers);
+    evhttp_add_header(&headers, "Content-Type", "application/octet-stream");
+    evhttp_add_header(&headers, "Content-Location", url);
+    evbuffer *buf = build_request_buffer(200, &headers);
+    evhttp_clear_headers(&headers);
+    merkle_tree *m = alloc(merkle_tree);
+    merkle_tree_add_evbuffer(m, buf);
+    evbuffer_free(buf);
+    for (uint64_t off = 0; off < size; off += sizeof(g_content)) {
+        merkle_tree_add_hashed_data(m, g_content, MIN(sizeof(g_content), size - off));
+    }
+    uint8_t root_hash[crypto_generichash_BYTES];
+    merkle_tree_get_root(m, root_hash);
+    merkle_tree_free(m);
+    size_t b64_len;
+    return base64_urlsafe_encode(root_hash, sizeof(root_hash), &b64_len);
+}
+
+void origin_request_cb(evhttp_request *req, void *arg)
+{
+    const char *path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
+    uint64_t size;
+    if (!path || sscanf(path, "/obj/%"SCNu64, &size) != 1 || size > ORIGIN_MAX_OBJECT) {
+        evhttp_send_error(req, 404, "Not Found");
+        return;
+    }
+    evkeyvalq *headers = evhttp_request_get_output_headers(req);
+    uint64_t start = 0;
+    uint64_t end = size - 1;
+    int code = 200;
+    const char *range = evhttp_find_header(evhttp_request_get_input_headers(req), "Range");
+    if (range && size) {
+        if (sscanf(range, "bytes=%"SCNu64"-%"SCNu64, &start, &end) < 1 || start > end || start >= size) {
+            evhttp_send_error(req, 416, "Range Not Satisfiable");
+            return;
+        }
+        end = MIN(end, size - 1);
+        char content_range[128];
+        snprintf(content_range, sizeof(content_range), "bytes %"PRIu64"-%"PRIu64"/%"PRIu64, start, end, size);
+        evhttp_add_header(headers, "Content-Range", content_range);
+        code = 206;
+    }
+    // the content repeats every sizeof(g_content) bytes
+    evbuffer *body = evbuffer_new();
+    for (uint64_t off = start; size && off <= end; ) {
+        size_t o = off % sizeof(g_content);
+        size_t len = MIN(sizeof(g_content) - o, end + 1 - off);
+        evbuffer_add_reference(body, g_content + o, len, NULL, NULL);
+        off += len;
+    }
+    evhttp_add_header(headers, "Content-Type", "application/octet-stream");
+    evhttp_add_header(headers, "Cache-Control", "public, max-age=3600");
+    evhttp_send_reply(req, code, code == 206 ? "Partial Content" : "OK", body);
+    evbuffer_free(body);
+}
+
+int origin(char *ports)
+{
+    evhttp *http = evhttp_new(g_evbase);
+    evhttp_set_gencb(http, origin_request_cb, NULL);
+    for (char *tok = strtok(ports, ","); tok; tok = strtok(NULL, ",")) {
+        const char *addr = "127.0.0.1";
+        char *port = strrchr(tok, ':');
+        if (port) {
+            *port++ = '\0';
+            addr = tok;
+        } else {
+            port = tok;
+        }
+        if (evhttp_bind_socket(http, addr, (port_t)atoi(port))) {
+            pdie("evhttp_bind_socket");
+        }
+        printf("origin listening on %s:%s\n", addr, port);
+    }
+    fflush(stdout);
+    return event_base_dispatch(g_evbase);
+}
+
+void worker_start(worker *w);
+
+void worker_next_cb(evutil_socket_t fd, short events, void *arg)
+{
+    worker_start((worker*)arg);
+}
+
+void worker_done(worker *w, bool ok)
+{
+    w->w->requests++;
+    if (ok) {
+        histogram_record(&w->w->latency, us_clock() - w->start);
+        w->w->bytes += w->received;
+    } else {
+        w->w->errors++;
+    }
+    if (g_trace) {
+        // replayed requests are scheduled up front
+        if (++g_replayed == g_trace_len) {
+            event_base_loopexit(g_evbase, NULL);
+        }
+        return;
+    }
+    // the connection may still be inside its own callback, start the next request from the loop
+    const timeval now = {0, 0};
+    event_base_once(g_evbase, -1, EV_TIMEOUT, worker_next_cb, w, &now);
+}
+
+void http_chunk_cb(evhttp_request *req, void *arg)
+{
+    worker *w = arg;
+    evbuffer *input = evhttp_request_get_input_buffer(req);
+    w->received += evbuffer_get_length(input);
+    evbuffer_drain(input, evbuffer_get_length(input));
+}
+
+void http_done_cb(evhttp_request *req, void *arg)
+{
+    worker *w = arg;
+    bool ok = false;
+    if (req) {
+        http_chunk_cb(req, w);
+        int code = evhttp_request_get_response_code(req);
+        if (w->w == &g_revalidate) {
+            ok = code == 304;
+        } else {
+            ok = (code == 200 || code == 206) && w->received == w->size;
+        }
+        if (!ok) {
+            debug("http %d %s received:%"PRIu64"/%"PRIu64"\n", evhttp_request_get_response_code(req),
+                  evhttp_request_get_response_code_line(req), w->received, w->size);
+        }
+    }
+    worker_done(w, ok);
+}
+
+void http_error_cb(evhttp_request_error error, void *arg)
+{
+    debug("http error: %s\n", evhttp_request_error_str(error));
+}
+
+void http_start(worker *w, const char *path)
+{
+    // evhttp closes proxy requests after the reply, so every request gets its own connection
+    evhttp_connection *evcon = evhttp_connection_base_new(g_evbase, NULL, w->proxy->host, w->proxy->port);
+    evhttp_connection_set_timeout(evcon, 60);
+    evhttp_connection_free_on_completion(evcon);
+    evhttp_request *req = evhttp_request_new(http_done_cb, w);
+    evhttp_request_set_chunked_cb(req, http_chunk_cb);
+    evhttp_request_set_error_cb(req, http_error_cb);
+    char host[300];
+    snprintf(host, sizeof(host), "%s:%u", g_origin.host, g_origin.port);
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Host", host);
+    if (w->w == &g_revalidate) {
+        evhttp_add_header(evhttp_request_get_output_headers(req), "If-None-Match", w->etag);
+    }
+    enum evhttp_cmd_type method = EVHTTP_REQ_GET;
+    if (w->entry) {
+        if (w->entry->range) {
+            char range[128];
+            snprintf(range, sizeof(range), "bytes=%"PRIu64"-%"PRIu64, w->entry->range_start, w->entry->range_end);
+            evhttp_add_header(evhttp_request_get_output_headers(req), "Range", range);
+        }
+        if (streq(w->entry->method, "HEAD")) {
+            method = EVHTTP_REQ_HEAD;
+        }
+    }
+    char url[2048];
+    snprintf(url, sizeof(url), "http://%s%s", host, path);
+    if (evhttp_make_request(evcon, req, method, url)) {
+        worker_done(w, false);
+    }
+}
+
+void tunnel_read_cb(bufferevent *bev, void *arg)
+{
+    worker *w = arg;
+    evbuffer *input = bufferevent_get_input(bev);
+    if (w->state != TUNNEL_BODY) {
+        evbuffer_ptr end = evbuffer_search(input, "\r\n\r\n", 4, NULL);
+        if (end.pos == -1) {
+            return;
+        }
+        // both the proxy's CONNECT reply and the origin's reply have to be 200
+        char status[16] = {0};
+        evbuffer_copyout(input, status, sizeof(status) - 1);
+        if (!strneq(status, "HTTP/1.1 200", strlen("HTTP/1.1 200")) &&
+            !strneq(status, "HTTP/1.0 200", strlen("HTTP/1.0 200"))) {
+            debug("tunnel %s: %s\n", w->state == TUNNEL_CONNECTING ? "connect" : "origin", status);
+            bufferevent_free(bev);
+            w->bev = NULL;
+            worker_done(w, false);
+            return;
+        }
+        evbuffer_drain(input, end.pos + 4);
+        if (w->state == TUNNEL_CONNECTING) {
+            w->state = TUNNEL_HEADERS;
+            evbuffer_add_printf(bufferevent_get_output(bev),
+                                "GET /obj/%"PRIu64"?%"PRIu64" HTTP/1.1\r\nHost: %s:%u\r\nConnection: close\r\n\r\n",
+                                w->size, g_issued, g_tunnel.host, g_tunnel.port);
+            tunnel_read_cb(bev, w);
+            return;
+        }
+        w->state = TUNNEL_BODY;
+    }
+    w->received += evbuffer_get_length(input);
+    evbuffer_drain(input, evbuffer_get_length(input));
+    if (w->received >= w->size) {
+        bufferevent_free(bev);
+        w->bev = NULL;
+        worker_done(w, w->received == w->size);
+    }
+}
+
+void tunnel_event_cb(bufferevent *bev, short events, void *arg)
+{
+    worker *w = arg;
+    if (events & BEV_EVENT_CONNECTED) {
+        return;
+    }
+    debug("tunnel %s received:%"PRIu64"/%"PRIu64"\n", bev_events_to_str(events), w->received, w->size);
+    bufferevent_free(bev);
+    w->bev = NULL;
+    worker_done(w, false);
+}
+
+void tunnel_start(worker *w)
+{
+    w->state = TUNNEL_CONNECTING;
+    w->bev = bufferevent_socket_new(g_evbase, -1, BEV_OPT_CLOSE_ON_FREE);
+    bufferevent_setcb(w->bev, tunnel_read_cb, NULL, tunnel_event_cb, w);
+    const timeval tv = {60, 0};
+    bufferevent_set_timeouts(w->bev, &tv, &tv);
+    bufferevent_enable(w->bev, EV_READ);
+    evbuffer_add_printf(bufferevent_get_output(w->bev), "CONNECT %s:%u HTTP/1.1\r\nHost: %s:%u\r\n\r\n",
+                        g_tunnel.host, g_tunnel.port, g_tunnel.host, g_tunnel.port);
+    if (bufferevent_socket_connect(w->bev, (sockaddr *)&w->proxy->ss, w->proxy->sslen)) {
+        bufferevent_free(w->bev);
+        w->bev = NULL;
+        worker_done(w, false);
+    }
+}
+
+void worker_start(worker *w)
+{
+    if ((o_requests && g_issued >= o_requests) || (g_deadline && us_clock() >= g_deadline)) {
+        if (!--g_active) {
+            event_base_loopexit(g_evbase, NULL);
+        }
+        return;
+    }
+    uint64_t i = g_issued++;
+    uint object;
+    if (o_populate) {
+        // every object of every size, in order
+        w->object = &g_sizes[(i / o_objects) % g_sizes_len];
+        object = i % o_objects;
+    } else {
+        w->object = pick_size();
+        object = (uint)random() % o_objects;
+    }
+    w->size = w->object->size;
+    w->received = 0;
+    w->start = us_clock();
+    if ((uint)random() % 100 < o_connect_pct) {
+        w->w = &g_connect;
+        tunnel_start(w);
+        return;
+    }
+    w->w = &g_http;
+    if (o_stable_urls && !o_populate && (uint)random() % 100 < o_revalidate_pct) {
+        w->w = &g_revalidate;
+    }
+    char path[128];
+    if (o_stable_urls && o_objects > 1) {
+        snprintf(path, sizeof(path), "/obj/%"PRIu64"?v=%u", w->size, object);
+    } else if (o_stable_urls) {
+        snprintf(path, sizeof(path), "/obj/%"PRIu64, w->size);
+    } else {
+        snprintf(path, sizeof(path), "/obj/%"PRIu64"?%"PRIu64, w->size, g_issued);
+    }
+    if (w->w == &g_revalidate) {
+        // the signed headers include the URL, so every object has its own root
+        if (!w->object->etags[object]) {
+            char url[2048];
+            snprintf(url, sizeof(url), "http://%s:%u%s", g_origin.host, g_origin.port, path);
+            w->object->etags[object] = content_etag(w->size, url);
+        }
+        w->etag = w->object->etags[object];
+    }
+    http_start(w, path);
+}
+
+void replay_start(evutil_socket_t fd, short events, void *arg)
+{
+    worker *w = arg;
+    const trace_entry *e = w->entry;
+    g_issued++;
+    w->size = e->bytes;
+    w->received = 0;
+    w->start = us_clock();
+    if (streq(e->method, "CONNECT")) {
+        w->w = &g_connect;
+        tunnel_start(w);
+        return;
+    }
+    w->w = &g_http;
+    // a ranged request's object is at least as long as the range
+    uint64_t size = e->range ? MAX(e->bytes, e->range_end + 1) : e->bytes;
+    char path[128];
+    snprintf(path, sizeof(path), "/obj/%"PRIu64"?u=%s", size, e->url);
+    http_start(w, path);
+}
+
+void load_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        pdie("fopen");
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        trace_entry e = {0};
+        uint64_t duration;
+        int code;
+        char source[32];
+        char range[64];
+        if (sscanf(line, "%"SCNu64" %"SCNu64" %15s %d %"SCNu64" %31s %63s %31s",
+                   &e.start_ms, &duration, e.method, &code, &e.bytes, source, range, e.url) != 8) {
+            continue;
+        }
+        e.range = sscanf(range, "%"SCNu64"-%"SCNu64, &e.range_start, &e.range_end) == 2;
+        g_trace = realloc(g_trace, (g_trace_len + 1) * sizeof(trace_entry));
+        g_trace[g_trace_len++] = e;
+    }
+    fclose(f);
+}
+
+void workload_report(const workload *w, double seconds)
+{
+    if (!w->requests) {
+        return;
+    }
+    printf("{\"workload\":\"%s\",\"requests\":%"PRIu64",\"errors\":%"PRIu64",\"error_rate\":%.4f,"
+           "\"seconds\":%.3f,\"requests_per_sec\":%.1f,\"bytes\":%"PRIu64",\"bytes_per_sec\":%.0f,"
+           "\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"max_ms\":%.3f}\n",
+           w->name, w->requests, w->errors, (double)w->errors / w->requests,
+           seconds, w->requests / seconds, w->bytes, w->bytes / seconds,
+           histogram_percentile(&w->latency, 0.5) / 1000.0,
+           histogram_percentile(&w->latency, 0.99) / 1000.0,
+           histogram_percentile(&w->latency, 0.999) / 1000.0,
+           w->latency.max / 1000.0);
+}
+
+// defined by caller
+void add_sockaddr(network *n, const sockaddr *addr, socklen_t addrlen)
+{
+}
+
+void dht_event_callback(void *closure, int event, const unsigned char *info_hash, const void *data, size_t data_len)
+{
+}
+
+void usage(char *name)
+{
+    fprintf(stderr, "\nUsage:\n");
+    fprintf(stderr, "    %s -O [<addr>:]<port>[,...]\n", name);
+    fprintf(stderr, "    %s -u <origin host:port> -x <proxy host:port>[,...] [options]\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -c <N>      Concurrent requests (default %u)\n", o_concurrency);
+    fprintf(stderr, "    -n <N>      Total requests, 0 for no limit (default %"PRIu64")\n", o_requests);
+    fprintf(stderr, "    -d <secs>   Stop issuing requests after this long\n");
+    fprintf(stderr, "    -s <list>   Object sizes as size[:weight],... (default 16384)\n");
+    fprintf(stderr, "    -C <pct>    Percent of requests sent as CONNECT tunnels\n");
+    fprintf(stderr, "    -t <addr>   CONNECT target (default 127.0.0.1:443)\n");
+    fprintf(stderr, "    -k          Reuse URLs so responses can be cached\n");
+    fprintf(stderr, "    -N <N>      Distinct cacheable objects of each size (default 1)\n");
+    fprintf(stderr, "    -P          Fetch every cacheable object once, then stop\n");
+    fprintf(stderr, "    -R <pct>    Percent of cacheable requests sent as revalidations\n");
+    fprintf(stderr, "    -r <file>   Replay a client trace (client -T) instead\n");
+    fprintf(stderr, "    -X <speed>  Replay this many times faster (default 1)\n");
+    fprintf(stderr, "    -S <seed>   Random seed for the request mix\n");
+    fprintf(stderr, "    -v          Verbose\n");
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    char *origin_ports = NULL;
+    char *origin_s = NULL;
+    char *proxies_s = NULL;
+    char *tunnel_s = "127.0.0.1:443";
+    char *sizes_s = NULL;
+    char *trace_s = NULL;
+
+    for (;;) {
+        int c = getopt(argc, argv, "O:u:x:t:c:n:d:s:C:kN:PR:r:X:S:v");
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+        case 'O':
+            origin_ports = optarg;
+            break;
+        case 'u':
+            origin_s = optarg;
+            break;
+        case 'x':
+            proxies_s = optarg;
+            break;
+        case 't':
+            tunnel_s = optarg;
+            break;
+        case 'c':
+            o_concurrency = MAX(atoi(optarg), 1);
+            break;
+        case 'n':
+            o_requests = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            o_duration = atof(optarg);
+            break;
+        case 's':
+            sizes_s = optarg;
+            break;
+        case 'C':
+            o_connect_pct = MIN(atoi(optarg), 100);
+            break;
+        case 'k':
+            o_stable_urls = true;
+            break;
+        case 'N':
+            o_objects = MAX(atoi(optarg), 1);
+            break;
+        case 'P':
+            o_populate = true;
+            break;
+        case 'R':
+            o_revalidate_pct = MIN(atoi(optarg), 100);
+            break;
+        case 'r':
+            trace_s = optarg;
+            break;
+        case 'X':
+            o_speed = atof(optarg);
+            if (o_speed <= 0) {
+                die("bad speed: %s\n", optarg);
+            }
+            break;
+        case 'S':
+            srandom(atoi(optarg));
+            break;
+        case 'v':
+            o_debug++;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    g_evbase = event_base_new();
+    fill_content();
+
+    if (origin_ports) {
+        return origin(origin_ports);
+    }
+
+    if (!origin_s || !proxies_s || !parse_endpoint(origin_s, &g_origin) || !parse_endpoint(tunnel_s, &g_tunnel)) {
+        usage(argv[0]);
+    }
+    g_proxies = parse_endpoints(proxies_s, &g_proxies_len);
+    if (!g_proxies_len) {
+        usage(argv[0]);
+    }
+    if (!o_requests && !o_duration) {
+        die("need -n or -d\n");
+    }
+    char default_sizes[] = "16384";
+    parse_sizes(sizes_s ? sizes_s : default_sizes);
+    if (o_populate) {
+        o_stable_urls = true;
+        o_connect_pct = 0;
+        o_requests = (uint64_t)g_sizes_len * o_objects;
+        o_duration = 0;
+    }
+    if (o_revalidate_pct) {
+        if (sodium_init() == -1) {
+            die("sodium_init failed\n");
+        }
+        for (uint i = 0; i < g_sizes_len; i++) {
+            g_sizes[i].etags = calloc(o_objects, sizeof(char*));
+        }
+    }
+
+    worker *workers;
+    g_start = us_clock();
+    if (trace_s) {
+        load_trace(trace_s);
+        if (!g_trace_len) {
+            die("empty trace: %s\n", trace_s);
+        }
+        // one worker per request, all scheduled now
+        workers = calloc(g_trace_len, sizeof(worker));
+        for (size_t i = 0; i < g_trace_len; i++) {
+            workers[i].proxy = &g_proxies[i % g_proxies_len];
+            workers[i].entry = &g_trace[i];
+            uint64_t at = (uint64_t)(g_trace[i].start_ms * 1000 / o_speed);
+            const timeval tv = {.tv_sec = at / 1000000, .tv_usec = at % 1000000};
+            event_base_once(g_evbase, -1, EV_TIMEOUT, replay_start, &workers[i], &tv);
+        }
+        event_base_dispatch(g_evbase);
+    } else {
+        if (o_duration) {
+            g_deadline = g_start + (uint64_t)(o_duration * 1000000);
+        }
+        workers = calloc(o_concurrency, sizeof(worker));
+        g_active = o_concurrency;
+        for (uint i = 0; i < o_concurrency; i++) {
+            workers[i].proxy = &g_proxies[i % g_proxies_len];
+            worker_start(&workers[i]);
+        }
+        if (g_active) {
+            event_base_dispatch(g_evbase);
+        }
+    }
+    double seconds = (us_clock() - g_start) / 1000000.0;
+
+    workload all = {.name = "all"};
+    const workload *ws[] = {&g_http, &g_revalidate, &g_connect};
+    for (size_t i = 0; i < lenof(ws); i++) {
+        workload_report(ws[i], seconds);
+        all.requests += ws[i]->requests;
+        all.errors += ws[i]->errors;
+        all.bytes += ws[i]->bytes;
+        for (uint b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            all.latency.counts[b] += ws[i]->latency.counts[b];
+        }
+        all.latency.count += ws[i]->latency.count;
+        all.latency.sum += ws[i]->latency.sum;
+        all.latency.max = MAX(all.latency.max, ws[i]->latency.max);
+    }
+    workload_report(&all, seconds);
+    free(workers);
+    return all.errors ? 2 : 0;
+}
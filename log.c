@@ -5,6 +5,13 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 #ifndef ANDROID
 #include <execinfo.h>
 #endif
@@ -14,6 +21,163 @@
 
 int o_debug = 0;
 
+#ifdef LOG_ASYNC
+// power of two
+#define LOG_RING_SIZE 2048
+#define LOG_RECORD_SIZE 512
+#define LOG_DRAIN_INTERVAL_MS 5
+
+// a slot is free for lap l when seq == 2l, and holds a record when seq == 2l + 1
+typedef struct {
+    _Atomic uint64_t seq;
+    uint32_t len;
+    char text[LOG_RECORD_SIZE - sizeof(uint64_t) - sizeof(uint32_t)];
+} log_record;
+
+log_record g_log_ring[LOG_RING_SIZE];
+_Atomic uint64_t g_log_head;
+uint64_t g_log_tail;
+_Atomic uint64_t g_log_dropped;
+_Atomic bool g_log_started;
+pthread_mutex_t g_log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// writes the records before position end, stopping at the first one not yet written. needs g_log_drain_lock
+void log_drain(uint64_t end)
+{
+    char buf[64 * 1024];
+    size_t used = 0;
+    while (g_log_tail < end) {
+        log_record *r = &g_log_ring[g_log_tail % LOG_RING_SIZE];
+        uint64_t lap = 2 * (g_log_tail / LOG_RING_SIZE);
+        bool ready = atomic_load_explicit(&r->seq, memory_order_acquire) == lap + 1;
+        if (!ready || used + r->len > sizeof(buf)) {
+            if (used) {
+                fwrite(buf, 1, used, stderr);
+                used = 0;
+            }
+            if (!ready) {
+                break;
+            }
+        }
+        memcpy(&buf[used], r->text, r->len);
+        used += r->len;
+        atomic_store_explicit(&r->seq, lap + 2, memory_order_release);
+        g_log_tail++;
+    }
+    if (used) {
+        fwrite(buf, 1, used, stderr);
+    }
+}
+
+void log_flush()
+{
+    pthread_mutex_lock(&g_log_drain_lock);
+    log_drain(UINT64_MAX);
+    uint64_t dropped = atomic_exchange(&g_log_dropped, 0);
+    if (dropped) {
+        fprintf(stderr, "[log] dropped %llu records\n", (unsigned long long)dropped);
+    }
+    fflush(stderr);
+    pthread_mutex_unlock(&g_log_drain_lock);
+}
+
+void* log_writer(void *arg)
+{
+    for (;;) {
+        log_flush();
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = LOG_DRAIN_INTERVAL_MS * 1000000};
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+void log_atfork_child()
+{
+    // the writer thread does not survive fork, and the parent's records are its own
+    memset(g_log_ring, 0, sizeof(g_log_ring));
+    atomic_store(&g_log_head, 0);
+    g_log_tail = 0;
+    pthread_mutex_init(&g_log_drain_lock, NULL);
+    atomic_store(&g_log_started, false);
+}
+
+void log_start()
+{
+    static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+    static bool registered;
+    pthread_mutex_lock(&start_lock);
+    if (!atomic_load(&g_log_started)) {
+        if (!registered) {
+            registered = true;
+            pthread_atfork(NULL, NULL, log_atfork_child);
+            atexit(log_flush);
+        }
+        pthread_t t;
+        if (!pthread_create(&t, NULL, log_writer, NULL)) {
+            pthread_detach(t);
+        }
+        atomic_store(&g_log_started, true);
+    }
+    pthread_mutex_unlock(&start_lock);
+}
+
+void log_async(const char *fmt, ...)
+{
+    if (!atomic_load_explicit(&g_log_started, memory_order_relaxed)) {
+        log_start();
+    }
+    uint64_t pos = atomic_load_explicit(&g_log_head, memory_order_relaxed);
+    log_record *r;
+    uint64_t lap;
+    for (;;) {
+        r = &g_log_ring[pos % LOG_RING_SIZE];
+        lap = 2 * (pos / LOG_RING_SIZE);
+        uint64_t seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+        if (seq == lap) {
+            if (atomic_compare_exchange_weak_explicit(&g_log_head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (seq < lap) {
+            // the writer is a full ring behind. never block the caller
+            atomic_fetch_add_explicit(&g_log_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&g_log_head, memory_order_relaxed);
+        }
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    va_list ap_direct;
+    va_copy(ap_direct, ap);
+    int len = vsnprintf(r->text, sizeof(r->text), fmt, ap);
+    va_end(ap);
+    bool oversized = len >= (int)sizeof(r->text);
+    r->len = (len < 0 || oversized) ? 0 : (uint32_t)len;
+    atomic_store_explicit(&r->seq, lap + 1, memory_order_release);
+    if (oversized) {
+        // too long for a slot. the slot goes out empty, and the line is written in full
+        // right after the records queued before it, which other threads may still be formatting
+        pthread_mutex_lock(&g_log_drain_lock);
+        for (;;) {
+            log_drain(pos + 1);
+            if (g_log_tail > pos) {
+                break;
+            }
+            sched_yield();
+        }
+        vfprintf(stderr, fmt, ap_direct);
+        fflush(stderr);
+        pthread_mutex_unlock(&g_log_drain_lock);
+    }
+    va_end(ap_direct);
+}
+#else
+void log_flush()
+{
+}
+#endif
+
 
 #ifdef ANDROID
 void bugsnag_log(const char *fmt, ...)
@@ -31,6 +195,7 @@ void bugsnag_log(const char *fmt, ...)
 void die(const char *fmt, ...)
 {
     va_list ap;
+    log_flush();
     fflush(stdout);
     va_start(ap, fmt);
     vfprintf(stderr, fmt, ap);
@@ -41,6 +206,7 @@ void die(const char *fmt, ...)
 void pdie(const char *err)
 {
     debug("%s: (%d) %s\n", err, errno, strerror(errno));
+    log_flush();
     assert(0);
 }
 
@@ -1,6 +1,7 @@
 #ifndef __LOG_H__
 #define __LOG_H__
 
+#include <stdio.h>
 #include <sys/types.h>
 
 extern int o_debug;
@@ -20,14 +21,33 @@ void bugsnag_log(const char *fmt, ...);
 #include <os/log.h>
 #define debug(...) if (o_debug) { fflush(stdout); fprintf(stderr, __VA_ARGS__); fflush(stderr); os_log(OS_LOG_DEFAULT, __VA_ARGS__); }
 #else
-#define debug(...) if (o_debug) { fflush(stdout); fprintf(stderr, __VA_ARGS__); fflush(stderr); }
+#define LOG_ASYNC 1
+// formatted on the calling thread into a lock-free ring, written to stderr by a background thread
+void log_async(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define debug(...) if (o_debug) { log_async(__VA_ARGS__); }
 #endif
 
+// debug() is level 1 and ddebug() level 2. -DLOG_LEVEL=0 compiles both out entirely,
+// the arguments are still type checked but never evaluated.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 2
+#endif
+
+#if LOG_LEVEL < 1
+#undef debug
+#define debug(...) if (0) { fprintf(stderr, __VA_ARGS__); }
+#endif
+
+#if LOG_LEVEL < 2
+#define ddebug(...) if (0) { fprintf(stderr, __VA_ARGS__); }
+#else
 #define ddebug(...) if (o_debug >= 2) { debug(__VA_ARGS__); }
+#endif
 
 void die(const char *fmt, ...);
 void pdie(const char *err);
 void hexdump(const void *p, size_t len);
 void print_trace(void);
+void log_flush(void);
 
 #endif // __LOG_H__
@@ -37,6 +37,7 @@ bool merkle_tree_set_leaves(merkle_tree *m, const uint8_t *data, size_t length)
     m->leaves_num = length / member_sizeof(node, hash);
     m->nodes_alloc = m->leaves_num*2 - 1;
     m->nodes = calloc(m->nodes_alloc, sizeof(node));
+    m->allocations++;
     memcpy(m->nodes, data, length);
     return true;
 }
@@ -49,6 +50,7 @@ void merkle_tree_set_leaf(merkle_tree *m, size_t leaf_idx, const uint8_t *hash)
         }
         m->nodes_alloc *= 2;
         m->nodes = realloc(m->nodes, m->nodes_alloc * sizeof(node));
+        m->allocations++;
     }
     memcpy(m->nodes[leaf_idx].hash, hash, sizeof(m->nodes[leaf_idx].hash));
     if (leaf_idx >= m->leaves_num) {
@@ -65,6 +67,7 @@ void merkle_tree_leaf_finish(merkle_tree *m)
         }
         m->nodes_alloc *= 2;
         m->nodes = realloc(m->nodes, m->nodes_alloc * sizeof(node));
+        m->allocations++;
     }
     crypto_generichash_final(&m->leaf_state, m->nodes[m->leaves_num].hash, sizeof(m->nodes[m->leaves_num].hash));
     m->leaves_num++;
@@ -80,6 +83,7 @@ void merkle_tree_add_hashed_data(merkle_tree *m, const uint8_t *data, size_t len
         }
         size_t len = MIN(LEAF_CHUNK_SIZE - m->leaf_progress, remain);
         crypto_generichash_update(&m->leaf_state, &data[length - remain], len);
+        m->bytes_hashed += len;
         remain -= len;
         m->leaf_progress += len;
         assert(m->leaf_progress <= LEAF_CHUNK_SIZE);
@@ -135,9 +139,11 @@ void merkle_tree_finish_leaves(merkle_tree *m)
 
     size_t nodes_num = m->leaves_num - 1;
     m->nodes = realloc(m->nodes, (m->leaves_num + nodes_num) * sizeof(node));
+    m->allocations++;
     if (m->leaves_num > 1) {
         for (size_t i = 0; i < m->leaves_num*2 - 2; i += 2) {
             node_hash(&m->nodes[i], &m->nodes[i+1], &m->nodes[m->leaves_num + i/2]);
+            m->bytes_hashed += 2 * sizeof(node);
         }
     }
 }
@@ -13,6 +13,9 @@ typedef struct {
     size_t leaves_num;
     size_t nodes_alloc;
     node *nodes;
+    // work done on this tree, for request_cost
+    uint64_t bytes_hashed;
+    uint64_t allocations;
 } merkle_tree;
 
 void merkle_tree_free(merkle_tree *m);
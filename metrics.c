@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+
+#include <event2/buffer.h>
+
+#include "dht/dht.h"
+
+#include "http.h"
+#include "network.h"
+#include "metrics.h"
+
+
+void metrics_header(evbuffer *out, const char *name, const char *type, const char *help)
+{
+    evbuffer_add_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_value(evbuffer *out, const char *name, const char *labels, uint64_t value)
+{
+    if (labels) {
+        evbuffer_add_printf(out, "%s{%s} %"PRIu64"\n", name, labels, value);
+    } else {
+        evbuffer_add_printf(out, "%s %"PRIu64"\n", name, value);
+    }
+}
+
+void metrics_counter(evbuffer *out, const char *name, const char *help, uint64_t value)
+{
+    metrics_header(out, name, "counter", help);
+    metrics_value(out, name, NULL, value);
+}
+
+void metrics_gauge(evbuffer *out, const char *name, const char *help, uint64_t value)
+{
+    metrics_header(out, name, "gauge", help);
+    metrics_value(out, name, NULL, value);
+}
+
+void network_metrics(network *n, evbuffer *out)
+{
+    metrics_header(out, "newnode_udp_packets_total", "counter", "UDP packets");
+    metrics_value(out, "newnode_udp_packets_total", "direction=\"in\"", g_udp_stats.recv_packets);
+    metrics_value(out, "newnode_udp_packets_total", "direction=\"out\"", g_udp_stats.sent_packets);
+    metrics_header(out, "newnode_udp_bytes_total", "counter", "UDP payload bytes");
+    metrics_value(out, "newnode_udp_bytes_total", "direction=\"in\"", g_udp_stats.recv_bytes);
+    metrics_value(out, "newnode_udp_bytes_total", "direction=\"out\"", g_udp_stats.sent_bytes);
+
+    utp_context_stats *stats = utp_get_context_stats(n->utp);
+    if (stats) {
+        const char *buckets[] = {"23", "373", "723", "1400", "+Inf"};
+        metrics_header(out, "newnode_utp_packets_total", "counter", "uTP packets by size bucket");
+        for (uint i = 0; i < lenof(buckets); i++) {
+            char labels[64];
+            snprintf(labels, sizeof(labels), "direction=\"in\",le=\"%s\"", buckets[i]);
+            metrics_value(out, "newnode_utp_packets_total", labels, stats->_nraw_recv[i]);
+            snprintf(labels, sizeof(labels), "direction=\"out\",le=\"%s\"", buckets[i]);
+            metrics_value(out, "newnode_utp_packets_total", labels, stats->_nraw_send[i]);
+        }
+    }
+
+    metrics_header(out, "newnode_dht_nodes", "gauge", "DHT routing table nodes");
+    if (n->dht) {
+        int afs[] = {AF_INET, AF_INET6};
+        for (uint i = 0; i < lenof(afs); i++) {
+            int good = 0;
+            int dubious = 0;
+            int cached = 0;
+            int incoming = 0;
+            dht_nodes(afs[i], &good, &dubious, &cached, &incoming);
+            const char *af = afs[i] == AF_INET ? "ipv4" : "ipv6";
+            char labels[64];
+            snprintf(labels, sizeof(labels), "af=\"%s\",state=\"good\"", af);
+            metrics_value(out, "newnode_dht_nodes", labels, good);
+            snprintf(labels, sizeof(labels), "af=\"%s\",state=\"dubious\"", af);
+            metrics_value(out, "newnode_dht_nodes", labels, dubious);
+            snprintf(labels, sizeof(labels), "af=\"%s\",state=\"cached\"", af);
+            metrics_value(out, "newnode_dht_nodes", labels, cached);
+        }
+        metrics_gauge(out, "newnode_dht_searches", "DHT searches in progress", dht_num_searches());
+        metrics_header(out, "newnode_dht_packets_total", "counter", "DHT packets");
+        metrics_value(out, "newnode_dht_packets_total", "direction=\"in\"", g_udp_stats.dht_recv_packets);
+        metrics_value(out, "newnode_dht_packets_total", "direction=\"out\"", g_udp_stats.dht_sent_packets);
+        metrics_header(out, "newnode_dht_bytes_total", "counter", "DHT payload bytes");
+        metrics_value(out, "newnode_dht_bytes_total", "direction=\"in\"", g_udp_stats.dht_recv_bytes);
+        metrics_value(out, "newnode_dht_bytes_total", "direction=\"out\"", g_udp_stats.dht_sent_bytes);
+    }
+
+    metrics_gauge(out, "newnode_origin_connections", "idle pooled origin connections (of 10)", connections_pooled());
+}
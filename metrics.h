@@ -0,0 +1,18 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+
+#include "network.h"
+
+
+// Prometheus text exposition format
+void metrics_header(evbuffer *out, const char *name, const char *type, const char *help);
+void metrics_value(evbuffer *out, const char *name, const char *labels, uint64_t value);
+void metrics_counter(evbuffer *out, const char *name, const char *help, uint64_t value);
+void metrics_gauge(evbuffer *out, const char *name, const char *help, uint64_t value);
+
+// udp, utp, dht and origin connection pool metrics shared by client and injector
+void network_metrics(network *n, evbuffer *out);
+
+#endif // __METRICS_H__
@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <sodium.h>
+
+#include <event2/event.h>
+
+#include "timer.h"
+#include "netem.h"
+#include "vtime.h"
+#include "network.h"
+
+
+typedef struct {
+    network *n;
+    // virtual time only
+    timer timer;
+    socklen_t salen;
+    sockaddr_storage sa;
+    size_t len;
+    uint8_t buf[];
+} netem_packet;
+
+netem o_netem;
+netem_stats g_netem_stats;
+
+
+bool netem_enabled()
+{
+    return o_netem.delay_us || o_netem.jitter_us || o_netem.loss > 0 || o_netem.reorder > 0;
+}
+
+bool netem_chance(double p)
+{
+    return p > 0 && randombytes_uniform(1000000) < p * 1000000;
+}
+
+void netem_deliver(evutil_socket_t fd, short events, void *arg)
+{
+    netem_packet *p = (netem_packet*)arg;
+    udp_received(p->n, p->buf, p->len, (const sockaddr *)&p->sa, p->salen);
+    utp_issue_deferred_acks(p->n->utp);
+    free(p);
+}
+
+void netem_timer_cb(void *arg)
+{
+    netem_deliver(-1, EV_TIMEOUT, arg);
+}
+
+void netem_received(network *n, const uint8_t *buf, size_t len, const sockaddr *sa, socklen_t salen)
+{
+    if (netem_chance(o_netem.loss)) {
+        g_netem_stats.dropped++;
+        return;
+    }
+    int64_t delay = (int64_t)o_netem.delay_us;
+    if (o_netem.jitter_us) {
+        delay += (int64_t)randombytes_uniform((uint32_t)(2 * o_netem.jitter_us + 1)) - (int64_t)o_netem.jitter_us;
+    }
+    if (netem_chance(o_netem.reorder)) {
+        // held long enough for the packets behind it to overtake it
+        delay += o_netem.delay_us + o_netem.jitter_us + 1000;
+        g_netem_stats.reordered++;
+    }
+    delay = MAX(delay, 0);
+    g_netem_stats.delayed++;
+
+    // the dht parser needs a byte past the end for a terminator
+    netem_packet *p = malloc(sizeof(netem_packet) + len + 1);
+    p->n = n;
+    p->salen = salen;
+    memcpy(&p->sa, sa, salen);
+    p->len = len;
+    memcpy(p->buf, buf, len);
+    p->buf[len] = '\0';
+    if (o_vtime) {
+        // virtual timers have millisecond resolution
+        timer_init(&p->timer, n, netem_timer_cb, p);
+        timer_schedule(&p->timer, (uint64_t)delay / 1000);
+        return;
+    }
+    const timeval tv = {.tv_sec = delay / 1000000, .tv_usec = delay % 1000000};
+    event_base_once(n->evbase, -1, EV_TIMEOUT, netem_deliver, p, &tv);
+}
@@ -0,0 +1,34 @@
+#ifndef __NETEM_H__
+#define __NETEM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "network.h"
+
+
+// impairs received UDP packets, to test the transport against a bad network on loopback.
+// applied where packets are read, so each direction is shaped by its receiver.
+typedef struct {
+    uint64_t delay_us;
+    // each packet gets delay_us +/- up to jitter_us, which also reorders some of them
+    uint64_t jitter_us;
+    // probabilities, 0 to 1
+    double loss;
+    double reorder;
+} netem;
+
+typedef struct {
+    uint64_t delayed;
+    uint64_t dropped;
+    uint64_t reordered;
+} netem_stats;
+
+// set before any traffic; all zero passes packets straight through
+extern netem o_netem;
+extern netem_stats g_netem_stats;
+
+bool netem_enabled(void);
+void netem_received(network *n, const uint8_t *buf, size_t len, const sockaddr *sa, socklen_t salen);
+
+#endif // __NETEM_H__
@@ -32,11 +32,18 @@
 #include "d2d.h"
 #include "http.h"
 #include "timer.h"
+#include "netem.h"
+#include "vtime.h"
 #include "network.h"
+#include "probes.h"
 #include "icmp_handler.h"
 #include "utp_bufferevent.h"
 
 
+udp_stats g_udp_stats;
+bool o_reuseport = false;
+int o_dht_forward_fd = -1;
+
 uint64 utp_on_firewall(utp_callback_arguments *a)
 {
     return 0;
@@ -72,6 +79,7 @@ void map6to4(const in6_addr *in, in_addr *out)
 int udp_sendto(int fd, const uint8_t *buf, size_t len, const sockaddr *sa, socklen_t salen)
 {
     ddebug("sendto(%zd, %s)\n", len, sockaddr_str(sa));
+    PROBE3(udp_send, fd, len, sa);
 
     if (o_debug >= 3) {
         hexdump(buf, len);
@@ -99,6 +107,10 @@ int udp_sendto(int fd, const uint8_t *buf, size_t len, const sockaddr *sa, sockl
     }
 
     ssize_t r = sendto(fd, buf, len, 0, sa, salen);
+    if (r >= 0) {
+        g_udp_stats.sent_packets++;
+        g_udp_stats.sent_bytes += r;
+    }
     if (r < 0 && errno != EHOSTUNREACH) {
         debug("sendto %s failed %d %s\n", sockaddr_str(sa), errno, strerror(errno));
     }
@@ -119,13 +131,17 @@ uint64 utp_callback_log(utp_callback_arguments *a)
 
 void dht_schedule(network *n, time_t tosleep)
 {
-    if (n->dht_timer) {
-        timer_cancel(n->dht_timer);
+    if (!n->dht) {
+        return;
     }
-    n->dht_timer = timer_start(n, tosleep * 1000, ^{
-        n->dht_timer = NULL;
-        dht_schedule(n, dht_tick(n->dht));
-    });
+    // rescheduled for every dht packet, so the timer is reused rather than reallocated
+    timer_schedule(&n->dht_timer, tosleep * 1000);
+}
+
+void dht_timer_cb(void *arg)
+{
+    network *n = (network*)arg;
+    dht_schedule(n, dht_tick(n->dht));
 }
 
 void udp_read(evutil_socket_t fd, short events, void *arg);
@@ -167,11 +183,21 @@ bool network_make_socket(network *n)
     setsockopt(n->fd, SOL_SOCKET, SO_RECV_ANYIF, &optval, sizeof(optval));
 #endif
 
+#ifdef SO_REUSEPORT
+    if (o_reuseport) {
+        int reuse = 1;
+        if (setsockopt(n->fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0) {
+            pdie("setsockopt SO_REUSEPORT");
+        }
+    }
+#endif
+
     port_t port = n->port;
     for (;;) {
         if (bind(n->fd, res->ai_addr, res->ai_addrlen) != 0) {
             debug("bind fail %d %s\n", errno, strerror(errno));
-            if (port == 0) {
+            // a shared port must not silently turn into a random one
+            if (port == 0 || o_reuseport) {
                 pdie("bind");
             }
             freeaddrinfo(res);
@@ -201,7 +227,9 @@ bool network_make_socket(network *n)
         dht_destroy(n->dht);
         n->dht = NULL;
     }
-    n->dht = dht_setup(n);
+    if (o_dht_forward_fd == -1) {
+        n->dht = dht_setup(n);
+    }
 
     sockaddr_storage ss;
     socklen_t ss_len = sizeof(ss);
@@ -214,12 +242,69 @@ bool network_make_socket(network *n)
     return true;
 }
 
+typedef struct {
+    socklen_t salen;
+    sockaddr_storage sa;
+} PACKED forward_header;
+
+void udp_forward(int fd, const uint8_t *buf, size_t len, const sockaddr *sa, socklen_t salen)
+{
+    forward_header h = {.salen = salen};
+    memcpy(&h.sa, sa, salen);
+    iovec iov[2] = {
+        {.iov_base = &h, .iov_len = sizeof(h)},
+        {.iov_base = (void*)buf, .iov_len = len}
+    };
+    msghdr msg = {.msg_iov = iov, .msg_iovlen = lenof(iov)};
+    if (sendmsg(fd, &msg, MSG_DONTWAIT) < 0) {
+        ddebug("%s sendmsg failed %d %s\n", __func__, errno, strerror(errno));
+    }
+}
+
+void udp_forward_read(evutil_socket_t fd, short events, void *arg)
+{
+    network *n = (network*)arg;
+    for (;;) {
+        forward_header h;
+        uint8_t buf[64 * 1024 + 1];
+        iovec iov[2] = {
+            {.iov_base = &h, .iov_len = sizeof(h)},
+            {.iov_base = buf, .iov_len = sizeof(buf) - 1}
+        };
+        msghdr msg = {.msg_iov = iov, .msg_iovlen = lenof(iov)};
+        ssize_t r = recvmsg(fd, &msg, MSG_DONTWAIT);
+        if (r < (ssize_t)sizeof(h)) {
+            break;
+        }
+        if (h.salen > sizeof(h.sa)) {
+            continue;
+        }
+        udp_received(n, buf, r - sizeof(h), (const sockaddr *)&h.sa, h.salen);
+    }
+}
+
+void network_accept_forwarded(network *n, int fd)
+{
+    evutil_make_socket_nonblocking(fd);
+    event *e = event_new(n->evbase, fd, EV_READ|EV_PERSIST, udp_forward_read, n);
+    event_add(e, NULL);
+}
+
 bool udp_received(network *n, uint8_t *buf, size_t len, const sockaddr *sa, socklen_t salen)
 {
     ddebug("udp_received(%zu, %s)\n", len, sockaddr_str(sa));
     if (utp_process_udp(n->utp, buf, len, sa, salen)) {
         return true;
     }
+    if (!n->dht) {
+        // another process on this port owns the dht
+        if (o_dht_forward_fd != -1) {
+            udp_forward(o_dht_forward_fd, buf, len, sa, salen);
+        }
+        return false;
+    }
+    g_udp_stats.dht_recv_packets++;
+    g_udp_stats.dht_recv_bytes += len;
     time_t tosleep;
     bool r = dht_process_udp(n->dht, buf, len, sa, salen, &tosleep);
     dht_schedule(n, tosleep);
@@ -260,6 +345,10 @@ void udp_read(evutil_socket_t fd, short events, void *arg)
 
         ddebug("recvfrom(%zu, %s)\n", len, sockaddr_str((const sockaddr *)&src_addr));
 
+        g_udp_stats.recv_packets++;
+        g_udp_stats.recv_bytes += len;
+        PROBE3(udp_recv, n->fd, len, &src_addr);
+
         const sockaddr *sa = (const sockaddr *)&src_addr;
         socklen_t salen = sockaddr_get_length(sa);
 
@@ -282,6 +371,11 @@ void udp_read(evutil_socket_t fd, short events, void *arg)
             hexdump(buf, len);
         }
 
+        if (netem_enabled()) {
+            netem_received(n, buf, len, sa, salen);
+            continue;
+        }
+
         udp_received(n, buf, len, sa, salen);
     }
 }
@@ -379,6 +473,16 @@ uint64 utp_callback_get_random(utp_callback_arguments *args)
     return r;
 }
 
+uint64 utp_callback_get_milliseconds(utp_callback_arguments *args)
+{
+    return vtime_us() / 1000;
+}
+
+uint64 utp_callback_get_microseconds(utp_callback_arguments *args)
+{
+    return vtime_us();
+}
+
 const char* bev_events_to_str(short events)
 {
     static char s[1024];
@@ -566,6 +670,9 @@ void network_free(network *n)
 {
     utp_destroy(n->utp);
     dht_destroy(n->dht);
+    if (n->evbase) {
+        timer_stop(&n->dht_timer);
+    }
     free(n->address);
     evutil_closesocket(n->fd);
     evdns_base_free(n->evdns, 0);
@@ -606,6 +713,7 @@ network* network_setup(char *address, port_t port)
     }
 
     fprintf(stderr, "libevent method: %s\n", event_base_get_method(n->evbase));
+    timer_init(&n->dht_timer, n, dht_timer_cb, n);
 
     // EVDNS_BASE_INITIALIZE_NAMESERVERS is broken on Android
     // https://github.com/libevent/libevent/issues/569
@@ -669,6 +777,10 @@ network* network_setup(char *address, port_t port)
     utp_set_callback(n->utp, UTP_ON_ERROR, &utp_on_error);
     utp_set_callback(n->utp, UTP_ON_STATE_CHANGE, &utp_on_state_change);
     utp_set_callback(n->utp, UTP_ON_READ, &utp_on_read);
+    if (o_vtime) {
+        utp_set_callback(n->utp, UTP_GET_MILLISECONDS, &utp_callback_get_milliseconds);
+        utp_set_callback(n->utp, UTP_GET_MICROSECONDS, &utp_callback_get_microseconds);
+    }
 
     if (o_debug >= 2) {
         utp_context_set_option(n->utp, UTP_LOG_NORMAL, 1);
@@ -696,7 +808,11 @@ int network_loop(network *n)
     event *sigterm = evsignal_new(n->evbase, SIGTERM, sigterm_cb, n->evbase);
     event_add(sigterm, NULL);
 
-    event_base_dispatch(n->evbase);
+    if (o_vtime) {
+        vtime_loop(n);
+    } else {
+        event_base_dispatch(n->evbase);
+    }
 
     utp_context_stats *stats = utp_get_context_stats(n->utp);
 
@@ -24,6 +24,7 @@ typedef struct network network;
 #define PACKED __attribute__((__packed__))
 #define lenof(x) (sizeof(x)/sizeof(x[0]))
 #define member_sizeof(type, member) sizeof(((type *)0)->member)
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
 #define alloc(type) calloc(1, sizeof(type))
 #define streq(a, b) (strcmp(a, b) == 0)
 #define strcaseeq(a, b) (strcasecmp(a, b) == 0)
@@ -51,6 +52,7 @@ typedef struct evbuffer evbuffer;
 typedef struct evbuffer_ptr evbuffer_ptr;
 typedef struct evbuffer_iovec evbuffer_iovec;
 typedef struct evbuffer_cb_info evbuffer_cb_info;
+typedef struct evbuffer_cb_entry evbuffer_cb_entry;
 typedef struct evbuffer_file_segment evbuffer_file_segment;
 typedef struct evconnlistener evconnlistener;
 typedef struct evutil_addrinfo evutil_addrinfo;
@@ -60,6 +62,7 @@ typedef struct timespec timespec;
 typedef struct tm tm;
 typedef struct addrinfo addrinfo;
 typedef struct rlimit rlimit;
+typedef struct rusage rusage;
 typedef struct in_addr in_addr;
 typedef struct in6_addr in6_addr;
 typedef struct sockaddr sockaddr;
@@ -67,6 +70,8 @@ typedef struct sockaddr_in sockaddr_in;
 typedef struct sockaddr_in6 sockaddr_in6;
 typedef struct sockaddr_un sockaddr_un;
 typedef struct sockaddr_storage sockaddr_storage;
+typedef struct iovec iovec;
+typedef struct msghdr msghdr;
 typedef enum bufferevent_flush_mode bufferevent_flush_mode;
 typedef enum bufferevent_filter_result bufferevent_filter_result;
 typedef in_port_t port_t;
@@ -83,10 +88,29 @@ struct network {
     event udp_event;
     utp_context *utp;
     dht *dht;
-    timer *dht_timer;
+    timer dht_timer;
     evhttp *http;
 };
 
+typedef struct {
+    uint64_t sent_packets;
+    uint64_t sent_bytes;
+    uint64_t recv_packets;
+    uint64_t recv_bytes;
+    // the dht's share of the above
+    uint64_t dht_sent_packets;
+    uint64_t dht_sent_bytes;
+    uint64_t dht_recv_packets;
+    uint64_t dht_recv_bytes;
+} udp_stats;
+
+extern udp_stats g_udp_stats;
+
+// set before network_setup(): share the UDP port with other processes (SO_REUSEPORT)
+extern bool o_reuseport;
+// set before network_setup(): don't run the dht, forward non-uTP packets to this fd instead
+extern int o_dht_forward_fd;
+
 void evbuffer_clear(evbuffer *buf);
 void evbuffer_hash_update(evbuffer *buf, crypto_generichash_state *content_state);
 bool evbuffer_write_to_file(evbuffer *buf, int fd);
@@ -106,6 +130,7 @@ bool bufferevent_is_localhost(const bufferevent *bev);
 int udp_sendto(int fd, const uint8_t *buf, size_t len, const sockaddr *sa, socklen_t salen);
 bool udp_received(network *n, uint8_t *buf, size_t len, const sockaddr *sa, socklen_t salen);
 network* network_setup(char *address, port_t port);
+void network_accept_forwarded(network *n, int fd);
 int network_loop(network *n);
 
 
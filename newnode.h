@@ -8,5 +8,7 @@ typedef void (^https_complete_callback)(bool success);
 typedef void (^https_callback)(const char *url, https_complete_callback cb);
 
 network* newnode_init(const char *app_name, const char *app_id, port_t *http_port, port_t *socks_port, https_callback https_cb);
+// use an injector at "host:port" without finding it on the DHT, for testing on a private network
+bool newnode_add_injector(network *n, const char *address);
 int newnode_run(network *n);
 void newnode_thread(network *n);
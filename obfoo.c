@@ -7,6 +7,7 @@
 #include <event2/bufferevent.h>
 
 #include "obfoo.h"
+#include "probes.h"
 
 
 int crypto_stream_chacha20_xor_ic_bytes(uint8_t *c, const uint8_t *m, size_t mlen,
@@ -218,6 +219,7 @@ ssize_t obfoo_input_filter(evbuffer *in, evbuffer *out, obfoo *o)
             return discard;
         }
         o->state = OF_STATE_READY;
+        PROBE2(obfoo_handshake, o, o->incoming);
     }
     case OF_STATE_READY: {
         return evbuffer_filter(in, out, ^bool (evbuffer_iovec v) {
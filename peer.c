@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <sodium.h>
+
+#include "khash.h"
+#include "peer.h"
+#include "network.h"
+
+
+khint_t peer_addr_hash(const peer *p)
+{
+    const uint8_t *b = (const uint8_t *)&p->addr;
+    khint_t h = 2166136261u;
+    for (socklen_t i = 0; i < sockaddr_get_length((const sockaddr *)&p->addr); i++) {
+        h = (h ^ b[i]) * 16777619u;
+    }
+    return h;
+}
+
+bool peer_addr_eq(const peer *a, const peer *b)
+{
+    return a->addr.ss_family == b->addr.ss_family &&
+        memeq(&a->addr, &b->addr, sockaddr_get_length((const sockaddr *)&a->addr));
+}
+
+KHASH_INIT(peer_addr, const peer*, char, 0, peer_addr_hash, peer_addr_eq);
+
+
+const char* peer_addr_str(const peer *p)
+{
+    return sockaddr_str((const sockaddr *)&p->addr);
+}
+
+peer* get_peer(peer_array *pa, const sockaddr *a, socklen_t alen)
+{
+    if (!pa->by_addr) {
+        return NULL;
+    }
+    peer key = {0};
+    memcpy(&key.addr, a, MIN(alen, sizeof(key.addr)));
+    khint_t k = kh_get(peer_addr, pa->by_addr, &key);
+    if (k == kh_end(pa->by_addr)) {
+        return NULL;
+    }
+    return (peer*)kh_key(pa->by_addr, k);
+}
+
+// the order select_peer() prefers: peers which didn't fail their last connect, less loaded
+// injectors (in coarse buckets, so similarly loaded ones still rotate), the least recently
+// tried, the most recently verified, ones which connected before, fewer loops, then at random
+int peer_cmp(const peer *a, const peer *b)
+{
+    bool a_failed = a->last_connect < a->last_connect_attempt;
+    bool b_failed = b->last_connect < b->last_connect_attempt;
+    if (a_failed != b_failed) {
+        return a_failed - b_failed;
+    }
+    if (a->load >> 4 != b->load >> 4) {
+        return (a->load >> 4) - (b->load >> 4);
+    }
+    if (a->last_connect_attempt != b->last_connect_attempt) {
+        return a->last_connect_attempt < b->last_connect_attempt ? -1 : 1;
+    }
+    if (a->last_verified != b->last_verified) {
+        return a->last_verified > b->last_verified ? -1 : 1;
+    }
+    if (!a->last_connect != !b->last_connect) {
+        return !a->last_connect - !b->last_connect;
+    }
+    if (a->loop != b->loop) {
+        return a->loop - b->loop;
+    }
+    if (a->salt != b->salt) {
+        return a->salt < b->salt ? -1 : 1;
+    }
+    return 0;
+}
+
+// heap helpers for arrays of peers. the peer_array heap tracks each peer's index, the
+// scratch heap in select_peer() doesn't
+void heap_set(peer **h, uint i, peer *p, bool track)
+{
+    h[i] = p;
+    if (track) {
+        p->index = i;
+    }
+}
+
+void heap_sift_up(peer **h, uint i, bool track)
+{
+    peer *p = h[i];
+    while (i) {
+        uint parent = (i - 1) / 2;
+        if (peer_cmp(h[parent], p) <= 0) {
+            break;
+        }
+        heap_set(h, i, h[parent], track);
+        i = parent;
+    }
+    heap_set(h, i, p, track);
+}
+
+void heap_sift_down(peer **h, uint len, uint i, bool track)
+{
+    peer *p = h[i];
+    for (;;) {
+        uint child = 2 * i + 1;
+        if (child >= len) {
+            break;
+        }
+        if (child + 1 < len && peer_cmp(h[child + 1], h[child]) < 0) {
+            child++;
+        }
+        if (peer_cmp(p, h[child]) <= 0) {
+            break;
+        }
+        heap_set(h, i, h[child], track);
+        i = child;
+    }
+    heap_set(h, i, p, track);
+}
+
+void peer_array_add(peer_array **pa, peer *p)
+{
+    (*pa)->length++;
+    *pa = realloc(*pa, sizeof(peer_array) + (*pa)->length * sizeof(peer*));
+    if (!(*pa)->by_addr) {
+        (*pa)->by_addr = kh_init(peer_addr);
+    }
+    int absent;
+    kh_put(peer_addr, (*pa)->by_addr, p, &absent);
+    p->array = pa;
+    p->salt = randombytes_random();
+    (*pa)->peers[(*pa)->length - 1] = p;
+    heap_sift_up((*pa)->peers, (*pa)->length - 1, true);
+}
+
+void peer_updated(peer *p)
+{
+    if (!p->array) {
+        return;
+    }
+    peer_array *pa = *p->array;
+    // a fresh place among equally preferred peers, like a new coin toss per selection
+    p->salt = randombytes_random();
+    heap_sift_up(pa->peers, p->index, true);
+    heap_sift_down(pa->peers, pa->length, p->index, true);
+}
+
+void peer_array_reorder(peer_array *pa)
+{
+    for (uint i = pa->length / 2; i-- > 0; ) {
+        heap_sift_down(pa->peers, pa->length, i, true);
+    }
+}
+
+peer* select_peer(peer_array *pa, peer_filter filter)
+{
+    if (!pa->length) {
+        return NULL;
+    }
+    if (!filter || !filter(pa->peers[0])) {
+        return pa->peers[0];
+    }
+    // best first through the heap: a rejected peer's children are the next candidates, so
+    // the cost grows with the number of rejected peers, not the number of peers
+    uint len = 0;
+    uint size = 16;
+    peer **candidates = malloc(size * sizeof(peer*));
+    peer *best = NULL;
+    peer *p = pa->peers[0];
+    for (;;) {
+        for (uint child = 2 * p->index + 1; child <= 2 * p->index + 2 && child < pa->length; child++) {
+            if (len == size) {
+                size *= 2;
+                candidates = realloc(candidates, size * sizeof(peer*));
+            }
+            candidates[len++] = pa->peers[child];
+            heap_sift_up(candidates, len - 1, false);
+        }
+        if (!len) {
+            break;
+        }
+        p = candidates[0];
+        candidates[0] = candidates[--len];
+        heap_sift_down(candidates, len, 0, false);
+        if (!filter(p)) {
+            best = p;
+            break;
+        }
+    }
+    free(candidates);
+    return best;
+}
@@ -0,0 +1,56 @@
+#ifndef __PEER_H__
+#define __PEER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "network.h"
+
+
+typedef struct peer_array peer_array;
+
+typedef struct {
+    sockaddr_storage addr;
+    time_t last_verified;
+    time_t last_connect;
+    time_t last_connect_attempt;
+    char via;
+    uint8_t loop;
+    // smoothed X-Load score, fits in existing padding so peer files keep their layout
+    uint8_t load;
+    // everything below is runtime state, not saved
+    peer_array **array;
+    uint index;
+    uint32_t salt;
+    // when load was last set from the injector itself, so decay spares fresh reports
+    time_t load_reported;
+} peer;
+
+// the peer files hold the fields before array
+#define PEER_FILE_SIZE offsetof(peer, array)
+
+// a binary heap ordered by preference, so the best peer is always peers[0]
+struct peer_array {
+    uint length;
+    struct kh_peer_addr_s *by_addr;
+    peer *peers[];
+};
+
+typedef bool (^peer_filter)(peer *p);
+
+const char* peer_addr_str(const peer *p);
+
+peer* get_peer(peer_array *pa, const sockaddr *a, socklen_t alen);
+void peer_array_add(peer_array **pa, peer *p);
+// <0 when a is preferred over b
+int peer_cmp(const peer *a, const peer *b);
+// call after changing any field select_peer() looks at
+void peer_updated(peer *p);
+// restores the order after changing many peers at once
+void peer_array_reorder(peer_array *pa);
+// the most preferred peer the filter doesn't reject
+peer* select_peer(peer_array *pa, peer_filter filter);
+
+#endif // __PEER_H__
@@ -0,0 +1,29 @@
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+// USDT static probes for perf and bpftrace, under the "newnode" provider:
+//   bpftrace -e 'usdt:./client:newnode:udp_recv { @bytes = hist(arg1); }'
+// an unattached probe is a single nop. builds without <sys/sdt.h>
+// (systemtap-sdt-dev), or with -DNO_PROBES, get no probes at all.
+#if !defined NO_PROBES && defined __has_include
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+#define PROBE(name) DTRACE_PROBE(newnode, name)
+#define PROBE1(name, a) DTRACE_PROBE1(newnode, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(newnode, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(newnode, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(newnode, name, a, b, c, d)
+#else
+#define PROBE(name)
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#define PROBE4(name, a, b, c, d)
+#endif
+
+#endif // __PROBES_H__
@@ -0,0 +1,229 @@
+#!/bin/bash
+
+# DHT and swarm simulation: injectors and clients on a private DHT, no internet needed.
+# Build with `DEBUG=1 ./build.sh` so the injector signs with the built-in test key.
+#
+#   INJECTORS=3 CLIENTS=20 ./sim.sh
+#
+# Runs in its own network namespace (unshare), so nothing leaks to the public DHT. The DHT
+# ignores loopback addresses, so every node is reached through SIM_ADDR on lo instead.
+# injector0 is the bootstrap node for everyone else. Prints one JSON line per phase:
+#   discovery    time from client start until it knows an injector
+#   swarm        time until a client finds, through the URL swarm, a peer that fetched the URL
+#   fetch        fetches of the URL through every client, and how many bytes came from peers
+#   dht          DHT traffic of all nodes over the whole run
+#
+# SEED=<n> runs every node in virtual-time mode (-S), node k seeded with n+k. REPLAY=1 runs the
+# whole simulation twice with the same SEED and diffs what the seed and the virtual epoch decide:
+# each node's DHT id and the injectors' first date-derived swarm names. Timings still come from
+# real packets, so they are not compared.
+
+set -e
+
+ORIGIN_PORT=${ORIGIN_PORT:-8000}
+INJECTOR_PORT=${INJECTOR_PORT:-8005}
+CLIENT_PORT=${CLIENT_PORT:-8100}
+INJECTORS=${INJECTORS:-2}
+CLIENTS=${CLIENTS:-8}
+SIM_ADDR=${SIM_ADDR:-10.77.0.1}
+# seconds between swarm announces and injector searches; the default 25 minutes is too slow here
+SWARM_INTERVAL=${SWARM_INTERVAL:-5}
+TIMEOUT=${TIMEOUT:-120}
+OBJECT_SIZE=${OBJECT_SIZE:-65536}
+
+if [ -n "$REPLAY" ]; then
+    export SEED=${SEED:-1}
+    OUT=$(mktemp -d)
+    REPLAY= "$0" "$@" > $OUT/1
+    REPLAY= "$0" "$@" > $OUT/2
+    grep '^replay ' $OUT/1 > $OUT/1.replay || true
+    grep '^replay ' $OUT/2 > $OUT/2.replay || true
+    if [ ! -s $OUT/1.replay ] || ! diff $OUT/1.replay $OUT/2.replay; then
+        echo "{\"phase\":\"replay\",\"seed\":$SEED,\"ok\":false,\"output\":\"$OUT\"}"
+        exit 1
+    fi
+    echo "{\"phase\":\"replay\",\"seed\":$SEED,\"ok\":true,\"lines\":$(wc -l < $OUT/1.replay)}"
+    rm -rf $OUT
+    exit 0
+fi
+
+if [ -z "$SIM_NETNS" ]; then
+    export SIM_NETNS=1
+    if [ $(id -u) = 0 ]; then
+        exec unshare -n "$0" "$@"
+    fi
+    exec unshare -rn "$0" "$@"
+fi
+ip link set lo up
+ip addr add $SIM_ADDR/16 dev lo
+
+BIN=$(cd $(dirname $0) && pwd)
+WORK=$(mktemp -d)
+
+function cleanup {
+    kill -SIGTERM $(jobs -pr) 2>/dev/null || true
+    rm -rf $WORK
+}
+trap cleanup EXIT
+trap 'exit 1' HUP INT TERM
+
+function now {
+    date +'%M:%S'
+}
+
+function ms {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+function wait_port {
+    for i in $(seq 100); do
+        if (echo > /dev/tcp/127.0.0.1/$1) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "$(now) port $1 did not open"
+    return 1
+}
+
+# vtime <node>: the seeded virtual-time options for a node, with -v so it logs its DHT id
+function vtime {
+    if [ -n "$SEED" ]; then
+        echo "-v -S $((SEED + $1))"
+    fi
+}
+
+# metric <port> <name{labels}>
+function metric {
+    curl -s http://127.0.0.1:$1/metrics | awk -v k="$2" '$1 == k { v = $2 } END { print v == "" ? 0 : v }'
+}
+
+# summary <name> <values...>: count, p50 and max of the values
+function summary {
+    local name=$1
+    shift
+    printf "%s\n" "$@" | sort -n | awk -v name=$name -v total=$CLIENTS '
+        NF { v[n++] = $1 }
+        END {
+            printf("{\"phase\":\"%s\",\"nodes\":%d,\"converged\":%d,\"p50_ms\":%d,\"max_ms\":%d}\n",
+                   name, total, n, n ? v[int((n - 1) / 2)] : 0, n ? v[n - 1] : 0)
+        }'
+}
+
+#-------------------------------------------------------------------------------
+echo "$(now) Starting origin."
+$BIN/loadgen -O $ORIGIN_PORT > $WORK/origin.log 2>&1 &
+wait_port $ORIGIN_PORT
+URL=http://127.0.0.1:$ORIGIN_PORT/obj/$OBJECT_SIZE
+
+#-------------------------------------------------------------------------------
+injectors=()
+for i in $(seq 0 $((INJECTORS - 1))); do
+    port=$((INJECTOR_PORT + i))
+    bootstrap=
+    if [ $i -gt 0 ]; then
+        bootstrap="-b $SIM_ADDR:$INJECTOR_PORT"
+    fi
+    mkdir -p $WORK/injector$i
+    echo "$(now) Starting injector on $port."
+    (cd $WORK/injector$i && exec $BIN/injector -p $port -r $SWARM_INTERVAL $bootstrap $(vtime $i) > log 2>&1) &
+    wait_port $port
+    injectors+=($port)
+done
+
+#-------------------------------------------------------------------------------
+clients=()
+started=()
+for i in $(seq 0 $((CLIENTS - 1))); do
+    # clients take two ports, http and socks
+    port=$((CLIENT_PORT + 2 * i))
+    mkdir -p $WORK/client$i
+    echo "$(now) Starting client on $port."
+    started+=($(ms))
+    (cd $WORK/client$i && exec $BIN/client -p $port -r $SWARM_INTERVAL -b $SIM_ADDR:$INJECTOR_PORT $(vtime $((INJECTORS + i))) > log 2>&1) &
+    wait_port $port
+    clients+=($port)
+done
+
+#-------------------------------------------------------------------------------
+echo "$(now) Waiting for injector discovery."
+discovered=()
+times=()
+deadline=$(( $(ms) + TIMEOUT * 1000 ))
+while [ ${#times[@]} -lt $CLIENTS ] && [ $(ms) -lt $deadline ]; do
+    for i in ${!clients[@]}; do
+        if [ -n "${discovered[$i]}" ]; then
+            continue
+        fi
+        if [ $(metric ${clients[$i]} 'newnode_peers{set="injectors"}') -gt 0 ]; then
+            discovered[$i]=1
+            times+=($(( $(ms) - ${started[$i]} )))
+        fi
+    done
+    sleep 0.2
+done
+summary discovery "${times[@]}"
+
+#-------------------------------------------------------------------------------
+echo "$(now) Seeding $URL through client0."
+curl -s -o /dev/null -x 127.0.0.1:${clients[0]} $URL || true
+seeded=$(ms)
+
+echo "$(now) Waiting for the URL swarm."
+converged=()
+times=()
+deadline=$(( seeded + TIMEOUT * 1000 ))
+while [ ${#times[@]} -lt $((CLIENTS - 1)) ] && [ $(ms) -lt $deadline ]; do
+    for i in ${!clients[@]}; do
+        if [ $i = 0 ] || [ -n "${converged[$i]}" ]; then
+            continue
+        fi
+        if [ $(metric ${clients[$i]} 'newnode_swarm_peers_found_total{swarm="url"}') -gt 0 ]; then
+            converged[$i]=1
+            times+=($(( $(ms) - seeded )))
+            continue
+        fi
+        # each request searches the URL swarm
+        curl -s -o /dev/null -m 5 -x 127.0.0.1:${clients[$i]} $URL?$RANDOM || true
+    done
+    sleep 0.2
+done
+CLIENTS=$((CLIENTS - 1)) summary swarm "${times[@]}"
+
+#-------------------------------------------------------------------------------
+echo "$(now) Fetching through every client."
+ok=0
+peer_bytes=0
+bytes=0
+for port in ${clients[@]}; do
+    size=$(curl -s -o /dev/null -m 30 -w '%{size_download}' -x 127.0.0.1:$port $URL || true)
+    if [ "$size" = $OBJECT_SIZE ]; then
+        ok=$((ok + 1))
+    fi
+    peer_bytes=$((peer_bytes + $(metric $port 'newnode_bytes_total{source="peer",direction="in"}')))
+    bytes=$((bytes + $(metric $port 'newnode_bytes_total{source="browser",direction="out"}')))
+done
+echo "{\"phase\":\"fetch\",\"nodes\":$CLIENTS,\"ok\":$ok,\"bytes\":$bytes,\"peer_bytes\":$peer_bytes}"
+
+#-------------------------------------------------------------------------------
+packets=0
+bytes=0
+for port in ${injectors[@]} ${clients[@]}; do
+    for dir in in out; do
+        packets=$((packets + $(metric $port "newnode_dht_packets_total{direction=\"$dir\"}")))
+        bytes=$((bytes + $(metric $port "newnode_dht_bytes_total{direction=\"$dir\"}")))
+    done
+done
+nodes=$((INJECTORS + CLIENTS))
+echo "{\"phase\":\"dht\",\"nodes\":$nodes,\"packets\":$packets,\"bytes\":$bytes,\"bytes_per_node\":$((bytes / nodes))}"
+
+if [ -n "$SEED" ]; then
+    for i in $(seq 0 $((INJECTORS - 1))); do
+        grep -m 2 '^dht id:\|^announcing injector ' $WORK/injector$i/log | sed "s/^/replay injector$i /"
+    done
+    for i in $(seq 0 $((CLIENTS - 1))); do
+        grep -m 1 '^dht id:' $WORK/client$i/log | sed "s/^/replay client$i /"
+    done
+fi
+
+echo "$(now) DONE"
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "timeline.h"
+
+
+FILE *g_timeline;
+uint64_t g_timeline_ids;
+
+bool timeline_open(const char *path)
+{
+    g_timeline = fopen(path, "w");
+    if (!g_timeline) {
+        return false;
+    }
+    // the closing ] is optional, so a killed process still leaves a readable file
+    fputs("[\n", g_timeline);
+    fflush(g_timeline);
+    return true;
+}
+
+bool timeline_enabled()
+{
+    return !!g_timeline;
+}
+
+uint64_t timeline_new_id()
+{
+    return ++g_timeline_ids;
+}
+
+void timeline_string(const char *s)
+{
+    fputc('"', g_timeline);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(g_timeline, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(g_timeline, "\\u%04x", c);
+        } else {
+            fputc(c, g_timeline);
+        }
+    }
+    fputc('"', g_timeline);
+}
+
+void timeline_name(uint64_t pid, uint64_t tid, const char *name)
+{
+    if (!g_timeline) {
+        return;
+    }
+    fprintf(g_timeline, "{\"ph\":\"M\",\"name\":\"%s\",\"pid\":%"PRIu64",\"tid\":%"PRIu64",\"args\":{\"name\":",
+            tid ? "thread_name" : "process_name", pid, tid);
+    timeline_string(name);
+    fputs("}},\n", g_timeline);
+}
+
+void timeline_span(uint64_t pid, uint64_t tid, const char *name, uint64_t start, uint64_t end)
+{
+    if (!g_timeline) {
+        return;
+    }
+    fputs("{\"ph\":\"X\",\"name\":", g_timeline);
+    timeline_string(name);
+    fprintf(g_timeline, ",\"pid\":%"PRIu64",\"tid\":%"PRIu64",\"ts\":%"PRIu64",\"dur\":%"PRIu64"},\n",
+            pid, tid, start, end - start);
+}
+
+void timeline_instant(uint64_t pid, uint64_t tid, const char *name, uint64_t ts)
+{
+    if (!g_timeline) {
+        return;
+    }
+    fputs("{\"ph\":\"i\",\"s\":\"t\",\"name\":", g_timeline);
+    timeline_string(name);
+    fprintf(g_timeline, ",\"pid\":%"PRIu64",\"tid\":%"PRIu64",\"ts\":%"PRIu64"},\n", pid, tid, ts);
+}
+
+void timeline_flush()
+{
+    if (g_timeline) {
+        fflush(g_timeline);
+    }
+}
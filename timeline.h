@@ -0,0 +1,19 @@
+#ifndef __TIMELINE_H__
+#define __TIMELINE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// spans in Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// each request is a "process" and each of its sources a "thread", so
+// parallel sources show up side by side. timestamps are us_clock() values.
+bool timeline_open(const char *path);
+bool timeline_enabled(void);
+uint64_t timeline_new_id(void);
+void timeline_name(uint64_t pid, uint64_t tid, const char *name);
+void timeline_span(uint64_t pid, uint64_t tid, const char *name, uint64_t start, uint64_t end);
+void timeline_instant(uint64_t pid, uint64_t tid, const char *name, uint64_t ts);
+void timeline_flush(void);
+
+#endif // __TIMELINE_H__
@@ -1,21 +1,87 @@
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "timer.h"
+#include "vtime.h"
 
 
+// virtual timers, ordered by deadline, then by when they were added
+TAILQ_HEAD(timer_list, timer) g_virtual_timers = TAILQ_HEAD_INITIALIZER(g_virtual_timers);
+
+// finished block timers are kept for the next timer_start(), up to this many
+#define TIMER_FREE_MAX 256
+struct timer_list g_free_timers = TAILQ_HEAD_INITIALIZER(g_free_timers);
+uint g_free_timers_len;
+
+
+timer* timer_alloc()
+{
+    timer *t = TAILQ_FIRST(&g_free_timers);
+    if (!t) {
+        return alloc(timer);
+    }
+    TAILQ_REMOVE(&g_free_timers, t, next);
+    g_free_timers_len--;
+    memset(t, 0, sizeof(timer));
+    return t;
+}
+
 void timer_free(timer *t)
 {
     assert(!evtimer_pending(&t->event, NULL));
+    assert(!t->queued);
+    assert(!t->func);
     Block_release(t->cb);
+    t->cb = NULL;
+    if (g_free_timers_len < TIMER_FREE_MAX) {
+        TAILQ_INSERT_HEAD(&g_free_timers, t, next);
+        g_free_timers_len++;
+        return;
+    }
     free(t);
 }
 
+void timer_enqueue(timer *t)
+{
+    timer *after;
+    TAILQ_FOREACH_REVERSE(after, &g_virtual_timers, timer_list, next) {
+        if (after->deadline_us <= t->deadline_us) {
+            break;
+        }
+    }
+    if (after) {
+        TAILQ_INSERT_AFTER(&g_virtual_timers, after, t, next);
+    } else {
+        TAILQ_INSERT_HEAD(&g_virtual_timers, t, next);
+    }
+    t->queued = true;
+}
+
+void timer_dequeue(timer *t)
+{
+    if (t->queued) {
+        TAILQ_REMOVE(&g_virtual_timers, t, next);
+        t->queued = false;
+    }
+}
+
 void evtimer_callback(evutil_socket_t fd, short events, void *arg)
 {
     timer *t = (timer*)arg;
+    if (t->func) {
+        // t may be freed or rescheduled by func
+        t->func(t->arg);
+        return;
+    }
+    bool persist = event_get_events(&t->event) & EV_PERSIST;
+    if (persist && t->interval_us) {
+        // like libevent, rescheduled before the callback so it can cancel
+        t->deadline_us += t->interval_us;
+        timer_enqueue(t);
+    }
     t->cb();
-    if (!(event_get_events(&t->event) & EV_PERSIST)) {
+    if (!persist) {
         timer_free(t);
     }
 }
@@ -23,25 +89,36 @@ void evtimer_callback(evutil_socket_t fd, short events, void *arg)
 void timer_cancel(timer *t)
 {
     evtimer_del(&t->event);
+    timer_dequeue(t);
     timer_free(t);
 }
 
-timer* timer_new(network *n, uint64_t timeout_ms, short events, timer_callback cb)
+void timer_arm(timer *t, uint64_t timeout_ms, bool persist)
 {
-    timer *t = alloc(timer);
-    t->cb = Block_copy(cb);
-    if (event_assign(&t->event, n->evbase, -1, events, evtimer_callback, t)) {
-        timer_free(t);
-        return NULL;
-    }
-    if (timeout_ms) {
+    if (timeout_ms && o_vtime) {
+        t->deadline_us = vtime_us() + timeout_ms * 1000;
+        t->interval_us = persist ? timeout_ms * 1000 : 0;
+        timer_enqueue(t);
+    } else if (timeout_ms) {
         timeval timeout;
         timeout.tv_sec = timeout_ms / 1000;
         timeout.tv_usec = (timeout_ms % 1000) * 1000;
         evtimer_add(&t->event, &timeout);
     } else {
-        event_active(&t->event, 0, 0);
+        // EV_TIMEOUT, so evtimer_pending() sees it until it runs
+        event_active(&t->event, EV_TIMEOUT, 0);
     }
+}
+
+timer* timer_new(network *n, uint64_t timeout_ms, short events, timer_callback cb)
+{
+    timer *t = timer_alloc();
+    t->cb = Block_copy(cb);
+    if (event_assign(&t->event, n->evbase, -1, events, evtimer_callback, t)) {
+        timer_free(t);
+        return NULL;
+    }
+    timer_arm(t, timeout_ms, events & EV_PERSIST);
     return t;
 }
 
@@ -54,3 +131,47 @@ timer* timer_repeating(network *n, uint64_t timeout_ms, timer_callback cb)
 {
     return timer_new(n, timeout_ms, EV_PERSIST, cb);
 }
+
+void timer_init(timer *t, network *n, timer_func func, void *arg)
+{
+    memset(t, 0, sizeof(timer));
+    t->func = func;
+    t->arg = arg;
+    event_assign(&t->event, n->evbase, -1, 0, evtimer_callback, t);
+}
+
+void timer_schedule(timer *t, uint64_t timeout_ms)
+{
+    timer_stop(t);
+    timer_arm(t, timeout_ms, false);
+}
+
+void timer_stop(timer *t)
+{
+    evtimer_del(&t->event);
+    timer_dequeue(t);
+}
+
+bool timer_scheduled(const timer *t)
+{
+    return t->queued || evtimer_pending(&t->event, NULL);
+}
+
+bool timer_next_deadline(uint64_t *deadline_us)
+{
+    timer *t = TAILQ_FIRST(&g_virtual_timers);
+    if (!t) {
+        return false;
+    }
+    *deadline_us = t->deadline_us;
+    return true;
+}
+
+void timer_activate_due(uint64_t now_us)
+{
+    timer *t;
+    while ((t = TAILQ_FIRST(&g_virtual_timers)) && t->deadline_us <= now_us) {
+        timer_dequeue(t);
+        event_active(&t->event, EV_TIMEOUT, 0);
+    }
+}
@@ -1,24 +1,51 @@
 #ifndef __TIMER_H__
 #define __TIMER_H__
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <Block.h>
+#include <sys/queue.h>
 
 #include <event2/event_struct.h>
 
 typedef struct timer timer;
 
-#include "network.h"
-
-
 typedef void (^timer_callback)(void);
+typedef void (*timer_func)(void *arg);
 
+// defined before network.h is included, so struct network can embed one
 struct timer {
-    event event;
+    struct event event;
     timer_callback cb;
+    // embedded timers (timer_init) only
+    timer_func func;
+    void *arg;
+    // virtual time (vtime.h) only
+    uint64_t deadline_us;
+    uint64_t interval_us;
+    bool queued:1;
+    TAILQ_ENTRY(timer) next;
 };
 
+#include "network.h"
+
+
+// one-shot and repeating timers with a block callback, freed when they finish or are cancelled
 timer* timer_start(network *n, uint64_t timeout_ms, timer_callback cb);
 timer* timer_repeating(network *n, uint64_t timeout_ms, timer_callback cb);
 void timer_cancel(timer *t);
 
+// a timer embedded in its owner, which can be scheduled any number of times without
+// allocating. func runs once per timer_schedule(), and may reschedule the timer or free
+// its owner. the owner calls timer_stop() before freeing it.
+void timer_init(timer *t, network *n, timer_func func, void *arg);
+// replaces any earlier schedule
+void timer_schedule(timer *t, uint64_t timeout_ms);
+void timer_stop(timer *t);
+bool timer_scheduled(const timer *t);
+
+// virtual time: the earliest deadline, and activating every timer due by now_us
+bool timer_next_deadline(uint64_t *deadline_us);
+void timer_activate_due(uint64_t now_us);
+
 #endif // __TIMER_H__
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <sodium.h>
+
+#include "trace.h"
+#include "vtime.h"
+
+
+FILE *g_trace;
+uint64_t g_trace_start;
+
+bool trace_open(const char *path)
+{
+    g_trace = fopen(path, "w");
+    if (!g_trace) {
+        return false;
+    }
+    // whole lines only, so a killed process still leaves a readable file
+    setvbuf(g_trace, NULL, _IOLBF, 0);
+    fputs("# start_ms duration_ms method code bytes source range url\n", g_trace);
+    g_trace_start = vtime_us();
+    return true;
+}
+
+void trace_record(uint64_t start, uint64_t end, const char *method, int code, uint64_t bytes,
+                  const char *source, bool range, uint64_t range_start, uint64_t range_end, const char *url)
+{
+    if (!g_trace) {
+        return;
+    }
+    uint8_t url_hash[crypto_generichash_BYTES_MIN];
+    crypto_generichash(url_hash, sizeof(url_hash), (const uint8_t*)url, strlen(url), NULL, 0);
+    char range_s[48] = "-";
+    if (range) {
+        snprintf(range_s, sizeof(range_s), "%"PRIu64"-%"PRIu64, range_start, range_end);
+    }
+    fprintf(g_trace, "%"PRIu64" %"PRIu64" %s %d %"PRIu64" %s %s ",
+            start > g_trace_start ? (start - g_trace_start) / 1000 : 0, (end - start) / 1000,
+            method, code, bytes, source, range_s);
+    // 64 bits is plenty to tell a trace's URLs apart
+    for (size_t i = 0; i < 8; i++) {
+        fprintf(g_trace, "%02x", url_hash[i]);
+    }
+    fputc('\n', g_trace);
+}
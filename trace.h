@@ -0,0 +1,19 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// compact trace of the requests the client serves, replayed with `loadgen -r`.
+// one line per request:
+//   start_ms duration_ms method code bytes source range url
+// start_ms counts from trace_open(), code is the status sent (0 if none was, e.g. the browser
+// went away first), range is the browser's "start-end" or "-" if it sent no Range, and url is a short hash of the URL so traces
+// can be shared; the same URL always gets the same hash.
+bool trace_open(const char *path);
+// start and end are us_clock() values
+void trace_record(uint64_t start, uint64_t end, const char *method, int code, uint64_t bytes,
+                  const char *source, bool range, uint64_t range_start, uint64_t range_end, const char *url);
+
+#endif // __TRACE_H__
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/http.h>
+
+#include "log.h"
+#include "utp.h"
+#include "http.h"
+#include "netem.h"
+#include "timer.h"
+#include "network.h"
+#include "histogram.h"
+#include "utp_bufferevent.h"
+
+
+// uTP transport benchmark. a forked server and this process talk over
+// utp_bufferevent on loopback, with netem impairing the packets both read.
+// per network profile: a few sequential 1 byte requests for the RTT, then one
+// bulk transfer for throughput and CPU. one JSON line per profile.
+
+typedef struct {
+    const char *name;
+    netem netem;
+    uint64_t bytes;
+} profile;
+
+profile profiles[] = {
+    {"loopback", {0, 0, 0, 0}, 64 * 1024 * 1024},
+    {"lan", {1000, 200, 0, 0}, 64 * 1024 * 1024},
+    {"broadband", {20000, 2000, 0.001, 0}, 16 * 1024 * 1024},
+    {"mobile", {50000, 10000, 0.01, 0.01}, 4 * 1024 * 1024},
+    {"lossy", {100000, 20000, 0.03, 0.02}, 1024 * 1024},
+};
+
+typedef enum {
+    PHASE_RTT,
+    PHASE_BULK,
+} bench_phase;
+
+typedef struct {
+    network *n;
+    const profile *p;
+    bufferevent *bev;
+    bench_phase phase;
+    uint rtt_samples;
+    histogram rtt;
+    uint64_t request_start;
+    int64_t content_length;
+    uint64_t received;
+    uint64_t bulk_start;
+    uint64_t bulk_end;
+    double bulk_cpu;
+    double server_cpu;
+    bool failed;
+} transfer;
+
+uint8_t g_content[64 * 1024];
+
+// control pipes to and from the server
+int g_server_in = -1;
+int g_server_out = -1;
+
+uint o_rtt_samples = 20;
+uint64_t o_bytes;
+uint o_timeout = 120;
+
+
+uint64_t us_clock()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+double cpu_seconds(int who)
+{
+    rusage ru;
+    getrusage(who, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+void serve_cb(evhttp_request *req, void *arg)
+{
+    uint64_t size;
+    if (sscanf(evhttp_request_get_uri(req), "/bytes/%"SCNu64, &size) != 1) {
+        evhttp_send_error(req, 404, "Not Found");
+        return;
+    }
+    evbuffer *body = evbuffer_new();
+    for (uint64_t off = 0; off < size; off += sizeof(g_content)) {
+        evbuffer_add_reference(body, g_content, MIN(sizeof(g_content), size - off), NULL, NULL);
+    }
+    evhttp_send_reply(req, 200, "OK", body);
+    evbuffer_free(body);
+}
+
+void server_control_cb(evutil_socket_t fd, short events, void *arg)
+{
+    network *n = arg;
+    // each netem from the parent replaces ours, and is answered with our CPU time so far
+    netem e;
+    if (read(fd, &e, sizeof(e)) != sizeof(e)) {
+        event_base_loopexit(n->evbase, NULL);
+        return;
+    }
+    o_netem = e;
+    double cpu = cpu_seconds(RUSAGE_SELF);
+    write(g_server_out, &cpu, sizeof(cpu));
+}
+
+pid_t serve(port_t *port)
+{
+    // forked before this process touches libevent, so the child starts clean
+    int in[2];
+    int out[2];
+    if (pipe(in) || pipe(out)) {
+        pdie("pipe");
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        pdie("fork");
+    }
+    if (!pid) {
+        close(in[1]);
+        close(out[0]);
+        g_server_out = out[1];
+        // keep our stdout for results
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        network *n = network_setup("::", 0);
+        evhttp_set_gencb(n->http, serve_cb, NULL);
+        event *control = event_new(n->evbase, in[0], EV_READ|EV_PERSIST, server_control_cb, n);
+        event_add(control, NULL);
+        write(g_server_out, &n->port, sizeof(n->port));
+        exit(network_loop(n));
+    }
+    close(in[0]);
+    close(out[1]);
+    g_server_in = in[1];
+    g_server_out = out[0];
+    if (read(g_server_out, port, sizeof(*port)) != sizeof(*port)) {
+        die("server did not start\n");
+    }
+    return pid;
+}
+
+double server_netem(const netem *e)
+{
+    double cpu;
+    if (write(g_server_in, e, sizeof(*e)) != sizeof(*e) ||
+        read(g_server_out, &cpu, sizeof(cpu)) != sizeof(cpu)) {
+        die("server control failed\n");
+    }
+    return cpu;
+}
+
+void transfer_request(transfer *t, uint64_t size)
+{
+    t->request_start = us_clock();
+    t->content_length = -1;
+    t->received = 0;
+    evbuffer_add_printf(bufferevent_get_output(t->bev), "GET /bytes/%"PRIu64" HTTP/1.1\r\nHost: bench\r\n\r\n", size);
+}
+
+void transfer_done(transfer *t, bool failed)
+{
+    t->failed = failed;
+    bufferevent_free(t->bev);
+    t->bev = NULL;
+    event_base_loopexit(t->n->evbase, NULL);
+}
+
+void transfer_read_cb(bufferevent *bev, void *arg)
+{
+    transfer *t = arg;
+    evbuffer *input = bufferevent_get_input(bev);
+    if (t->content_length == -1) {
+        evbuffer_ptr end = evbuffer_search(input, "\r\n\r\n", 4, NULL);
+        if (end.pos == -1) {
+            return;
+        }
+        char *headers = strndup((char*)evbuffer_pullup(input, end.pos), end.pos);
+        char *cl = strcasestr(headers, "\r\nContent-Length:");
+        if (!strneq(headers, "HTTP/1.1 200", strlen("HTTP/1.1 200")) || !cl) {
+            debug("bad response: %s\n", headers);
+            free(headers);
+            transfer_done(t, true);
+            return;
+        }
+        t->content_length = strtoll(cl + strlen("\r\nContent-Length:"), NULL, 10);
+        free(headers);
+        evbuffer_drain(input, end.pos + 4);
+    }
+    size_t len = MIN(evbuffer_get_length(input), (size_t)(t->content_length - t->received));
+    t->received += len;
+    evbuffer_drain(input, len);
+    if ((int64_t)t->received < t->content_length) {
+        return;
+    }
+    if (t->phase == PHASE_RTT) {
+        histogram_record(&t->rtt, us_clock() - t->request_start);
+        if (++t->rtt_samples < o_rtt_samples) {
+            transfer_request(t, 1);
+            return;
+        }
+        t->phase = PHASE_BULK;
+        t->bulk_cpu = cpu_seconds(RUSAGE_SELF);
+        t->server_cpu = server_netem(&o_netem);
+        t->bulk_start = us_clock();
+        transfer_request(t, t->p->bytes);
+        return;
+    }
+    t->bulk_end = us_clock();
+    t->bulk_cpu = cpu_seconds(RUSAGE_SELF) - t->bulk_cpu;
+    t->server_cpu = server_netem(&o_netem) - t->server_cpu;
+    transfer_done(t, false);
+}
+
+void transfer_event_cb(bufferevent *bev, short events, void *arg)
+{
+    transfer *t = arg;
+    if (events & BEV_EVENT_CONNECTED) {
+        transfer_request(t, 1);
+        return;
+    }
+    debug("transfer %s received:%"PRIu64"\n", bev_events_to_str(events), t->received);
+    transfer_done(t, true);
+}
+
+void run_profile(network *n, port_t port, const profile *p)
+{
+    o_netem = p->netem;
+    server_netem(&o_netem);
+    g_netem_stats = (netem_stats){0};
+
+    transfer *t = alloc(transfer);
+    t->n = n;
+    t->p = p;
+    t->phase = PHASE_RTT;
+    sockaddr_in sin = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = inet_addr("127.0.0.1"),
+        .sin_port = htons(port),
+#ifdef __APPLE__
+        .sin_len = sizeof(sin)
+#endif
+    };
+    utp_socket *s = utp_create_socket(n->utp);
+    t->bev = utp_socket_create_bev(n->evbase, s);
+    bufferevent_setcb(t->bev, transfer_read_cb, NULL, transfer_event_cb, t);
+    bufferevent_enable(t->bev, EV_READ|EV_WRITE);
+    utp_connect(s, (const sockaddr *)&sin, sizeof(sin));
+
+    __block timer *timeout = timer_start(n, o_timeout * 1000, ^{
+        debug("%s timed out\n", p->name);
+        timeout = NULL;
+        transfer_done(t, true);
+    });
+    event_base_dispatch(n->evbase);
+    if (timeout) {
+        timer_cancel(timeout);
+    }
+
+    double seconds = t->failed ? 0 : (t->bulk_end - t->bulk_start) / 1e6;
+    double gb = p->bytes / 1e9;
+    printf("{\"profile\":\"%s\",\"delay_ms\":%.1f,\"jitter_ms\":%.1f,\"loss\":%.4f,\"reorder\":%.4f,"
+           "\"ok\":%s,\"bytes\":%"PRIu64",\"seconds\":%.3f,\"bytes_per_sec\":%.0f,"
+           "\"rtt_p50_ms\":%.3f,\"rtt_max_ms\":%.3f,\"client_cpu_s_per_gb\":%.3f,\"server_cpu_s_per_gb\":%.3f,"
+           "\"dropped\":%"PRIu64",\"reordered\":%"PRIu64"}\n",
+           p->name, p->netem.delay_us / 1000.0, p->netem.jitter_us / 1000.0, p->netem.loss, p->netem.reorder,
+           t->failed ? "false" : "true", t->failed ? t->received : p->bytes,
+           seconds, t->failed ? 0 : p->bytes / seconds,
+           histogram_percentile(&t->rtt, 0.5) / 1000.0, t->rtt.max / 1000.0,
+           t->failed ? 0 : t->bulk_cpu / gb, t->failed ? 0 : t->server_cpu / gb,
+           g_netem_stats.dropped, g_netem_stats.reordered);
+    fflush(stdout);
+    free(t);
+}
+
+// defined by caller
+void add_sockaddr(network *n, const sockaddr *addr, socklen_t addrlen)
+{
+}
+
+void dht_event_callback(void *closure, int event, const unsigned char *info_hash, const void *data, size_t data_len)
+{
+}
+
+void usage(char *name)
+{
+    fprintf(stderr, "\nUsage:\n");
+    fprintf(stderr, "    %s [options] [profile...]\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Profiles:\n");
+    for (size_t i = 0; i < lenof(profiles); i++) {
+        const profile *p = &profiles[i];
+        fprintf(stderr, "    %-10s  delay %"PRIu64"ms +/- %"PRIu64"ms, %.1f%% loss, %.1f%% reordered, %"PRIu64" bytes\n",
+                p->name, p->netem.delay_us / 1000, p->netem.jitter_us / 1000, p->netem.loss * 100,
+                p->netem.reorder * 100, p->bytes);
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -b <bytes>  Bulk transfer size for every profile\n");
+    fprintf(stderr, "    -r <N>      RTT samples (default %u)\n", o_rtt_samples);
+    fprintf(stderr, "    -t <secs>   Per profile timeout (default %u)\n", o_timeout);
+    fprintf(stderr, "    -v          Verbose\n");
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    for (;;) {
+        int c = getopt(argc, argv, "b:r:t:v");
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+        case 'b':
+            o_bytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            o_rtt_samples = MAX(atoi(optarg), 1);
+            break;
+        case 't':
+            o_timeout = MAX(atoi(optarg), 1);
+            break;
+        case 'v':
+            o_debug++;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(g_content); i++) {
+        g_content[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+
+    port_t port;
+    pid_t server = serve(&port);
+    network *n = network_setup("::", 0);
+    if (!n) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < lenof(profiles); i++) {
+        profile *p = &profiles[i];
+        bool selected = optind == argc;
+        for (int a = optind; a < argc; a++) {
+            selected |= streq(argv[a], p->name);
+        }
+        if (!selected) {
+            continue;
+        }
+        if (o_bytes) {
+            p->bytes = o_bytes;
+        }
+        run_profile(n, port, p);
+    }
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    return 0;
+}
@@ -10,6 +10,7 @@
 #include "utp_bufferevent.h"
 #include "obfoo.h"
 #include "log.h"
+#include "probes.h"
 
 
 // utp_read > decrypt > bev_output > other_fd_recv
@@ -166,6 +167,11 @@ uint64 utp_on_state_change(utp_callback_arguments *a)
     if (a->state != UTP_STATE_WRITABLE) {
         //debug("utp_on_state_change state:%d %s\n", a->state, utp_state_names[a->state]);
     }
+    if (a->state == UTP_STATE_CONNECT) {
+        PROBE1(utp_connected, a->socket);
+    } else if (a->state == UTP_STATE_DESTROYING) {
+        PROBE1(utp_close, a->socket);
+    }
     if (!u) {
         return 0;
     }
@@ -0,0 +1,118 @@
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <sodium.h>
+
+#include <event2/event.h>
+
+#include "log.h"
+#include "timer.h"
+#include "vtime.h"
+#include "network.h"
+
+
+// how long the loop waits for real events before the clock jumps ahead
+#define VTIME_IDLE_US 1000
+
+bool o_vtime = false;
+
+uint64_t g_vtime_us;
+time_t g_vtime_epoch;
+uint64_t g_rng_state;
+
+
+uint64_t rng_next()
+{
+    // splitmix64
+    uint64_t z = (g_rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+const char* rng_name()
+{
+    return "vtime";
+}
+
+uint32_t rng_random()
+{
+    return (uint32_t)rng_next();
+}
+
+void rng_buf(void * const buf, const size_t size)
+{
+    uint8_t *b = buf;
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t r = rng_next();
+        memcpy(&b[i], &r, MIN(sizeof(r), size - i));
+    }
+}
+
+randombytes_implementation rng_implementation = {
+    .implementation_name = rng_name,
+    .random = rng_random,
+    .buf = rng_buf,
+};
+
+void vtime_setup(const char *arg)
+{
+    char *epoch;
+    uint64_t seed = strtoull(arg, &epoch, 10);
+    o_vtime = true;
+    g_rng_state = seed;
+    randombytes_set_implementation(&rng_implementation);
+    g_vtime_epoch = *epoch == ',' ? (time_t)strtoll(epoch + 1, NULL, 10) : VTIME_EPOCH;
+    g_vtime_us = 0;
+}
+
+uint64_t vtime_us()
+{
+    if (o_vtime) {
+        return g_vtime_us;
+    }
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+time_t vtime_time()
+{
+    if (o_vtime) {
+        return g_vtime_epoch + (time_t)(g_vtime_us / 1000000);
+    }
+    return time(NULL);
+}
+
+void vtime_idle_cb(evutil_socket_t fd, short events, void *arg)
+{
+    *(bool*)arg = true;
+}
+
+void vtime_loop(network *n)
+{
+    bool idle = false;
+    event *idle_timer = evtimer_new(n->evbase, vtime_idle_cb, &idle);
+    for (;;) {
+        idle = false;
+        const timeval tv = {0, VTIME_IDLE_US};
+        evtimer_add(idle_timer, &tv);
+        event_base_loop(n->evbase, EVLOOP_ONCE);
+        if (event_base_got_exit(n->evbase) || event_base_got_break(n->evbase)) {
+            break;
+        }
+        if (!idle) {
+            evtimer_del(idle_timer);
+            continue;
+        }
+        uint64_t deadline;
+        if (timer_next_deadline(&deadline) && deadline > g_vtime_us) {
+            ddebug("vtime advance %"PRIu64"us\n", deadline - g_vtime_us);
+            g_vtime_us = deadline;
+        }
+        timer_activate_due(g_vtime_us);
+    }
+    event_free(idle_timer);
+}
@@ -0,0 +1,34 @@
+#ifndef __VTIME_H__
+#define __VTIME_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "network.h"
+
+
+// deterministic test mode. timer.c timers, uTP's clock and netem run on a virtual clock
+// which only moves when the event loop has been idle for a moment, and then jumps straight
+// to the next timer, so a 25 minute refresh takes a millisecond. randombytes comes from a
+// seeded generator, so a run can be replayed (and every key it makes is predictable).
+// still real time: libevent's own timeouts (evhttp, bufferevents), the dht's internal
+// clock, and packets from other processes.
+extern bool o_vtime;
+
+// the virtual clock starts here (2020-01-01) unless -S gives an epoch, so dates, signature
+// timestamps and the day-based swarm names replay along with everything else
+#define VTIME_EPOCH 1577836800
+
+// "seed[,epoch]". call before network_setup() and any use of randombytes
+void vtime_setup(const char *arg);
+
+// microseconds since vtime_setup(), or monotonic real time when not virtual
+uint64_t vtime_us(void);
+// time(NULL), moved forward by the virtual clock
+time_t vtime_time(void);
+
+// runs the loop until event_base_loopexit(), advancing the clock whenever it is idle
+void vtime_loop(network *n);
+
+#endif // __VTIME_H__